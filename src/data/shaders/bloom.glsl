@@ -20,25 +20,32 @@ out vec4 color;
 in vec2 uv;
 
 uniform sampler2D u_texture;
-uniform bool u_hor;
-
-const float weight[5] = float[] (0.227027, 0.1945946, 0.1216216, 0.054054, 0.016216);
+uniform bool u_up;
 
+// dual filter, box of 5 taps on the way down and a tent of 8 on the way up,
+// offsets are half a source texel so each tap lands between four texels
 void main()
 {
-  vec2 tex_offset = 1.0 / textureSize(u_texture, 0);
-  vec3 result = texture(u_texture, uv).rgb * weight[0];
-
-  if (u_hor) {
-    for (int i=1; i<5; i++) {
-      result += texture(u_texture, uv + vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
-      result += texture(u_texture, uv - vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
-    }
+  vec2 hp = 0.5 / textureSize(u_texture, 0);
+  vec3 result;
+
+  if (!u_up) {
+    result  = texture(u_texture, uv).rgb * 4.0;
+    result += texture(u_texture, uv - hp).rgb;
+    result += texture(u_texture, uv + hp).rgb;
+    result += texture(u_texture, uv + vec2(hp.x, -hp.y)).rgb;
+    result += texture(u_texture, uv - vec2(hp.x, -hp.y)).rgb;
+    result /= 8.0;
   } else {
-    for (int i=1; i<5; i++) {
-      result += texture(u_texture, uv + vec2(0.0, tex_offset.y * i)).rgb * weight[i];
-      result += texture(u_texture, uv - vec2(0.0, tex_offset.y * i)).rgb * weight[i];
-    }
+    result  = texture(u_texture, uv + vec2(-hp.x * 2.0, 0.0)).rgb;
+    result += texture(u_texture, uv + vec2( hp.x * 2.0, 0.0)).rgb;
+    result += texture(u_texture, uv + vec2(0.0, -hp.y * 2.0)).rgb;
+    result += texture(u_texture, uv + vec2(0.0,  hp.y * 2.0)).rgb;
+    result += texture(u_texture, uv + vec2(-hp.x,  hp.y)).rgb * 2.0;
+    result += texture(u_texture, uv + vec2( hp.x,  hp.y)).rgb * 2.0;
+    result += texture(u_texture, uv + vec2(-hp.x, -hp.y)).rgb * 2.0;
+    result += texture(u_texture, uv + vec2( hp.x, -hp.y)).rgb * 2.0;
+    result /= 12.0;
   }
 
   color = vec4(result, 1.0);
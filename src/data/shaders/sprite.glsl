@@ -1,9 +1,8 @@
 #START VS
 #version 330 core
 
-layout (location = 0) in vec2 in_position;
-layout (location = 1) in vec2 in_uv;
-layout (location = 2) in vec4 in_color;
+layout (location = 0) in uint in_tile;
+layout (location = 1) in vec4 in_color;
 
 out vec2 uv;
 out vec4 col;
@@ -11,12 +10,25 @@ out vec4 col;
 uniform mat4 u_projection;
 uniform mat4 u_model;
 uniform vec2 u_uv;
+uniform vec2 u_size;
+uniform int u_columns;
+uniform samplerBuffer u_tile_uv;
+
+// two triangles per cell
+const vec2 corners[6] = vec2[6](
+  vec2(0.0, 1.0), vec2(0.0, 0.0), vec2(1.0, 0.0),
+  vec2(0.0, 1.0), vec2(1.0, 0.0), vec2(1.0, 1.0)
+);
 
 void main()
 {
-  gl_Position = u_projection * u_model * vec4(in_position, 0.0, 1.0);
-  uv          = in_uv + u_uv;
-  col         = in_color;
+  vec2 corner = corners[gl_VertexID];
+  vec2 cell   = vec2(gl_InstanceID % u_columns, gl_InstanceID / u_columns);
+  vec4 rect   = texelFetch(u_tile_uv, int(in_tile));
+
+  gl_Position = u_projection * u_model * vec4((cell + corner) * u_size, 0.0, 1.0);
+  uv          = mix(rect.xy, rect.zw, corner) + u_uv;
+  col         = in_tile == 0u ? vec4(0.0) : in_color;
 }
 #END VS
 
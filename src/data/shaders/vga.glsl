@@ -23,11 +23,26 @@ in vec2 uv;
 
 out vec4 color;
 
-uniform sampler2D u_texture;
+uniform usampler2D u_cells;
+uniform usampler2D u_font;
+uniform ivec2 u_glyph;
+
+vec4 unpack(uint c)
+{
+  return vec4(c & 0xFFu, (c >> 8) & 0xFFu, (c >> 16) & 0xFFu, c >> 24) / 255.0;
+}
 
 void main()
 {
-  vec4 sample = texture(u_texture, vec2(uv.x, uv.y)).rgba;
-  color = sample;
+  // pixel inside the grid, then the cell and the pixel inside its glyph
+  ivec2 p = ivec2(uv * vec2(textureSize(u_cells, 0) * u_glyph));
+  ivec2 g = p % u_glyph;
+  uvec3 cell = texelFetch(u_cells, p / u_glyph, 0).rgb;
+
+  // glyph rows are a byte each, leftmost pixel in the high bit
+  uint row = texelFetch(u_font, ivec2(g.y, int(cell.r)), 0).r;
+  bool on = ((row >> uint(u_glyph.x - 1 - g.x)) & 1u) != 0u;
+
+  color = unpack(on ? cell.g : cell.b);
 }
 #END FS
\ No newline at end of file
@@ -10,24 +10,196 @@ extern tilesheet_packet_t level, entity_tiles;
 u8 level_alpha[TILES_NUM] = {0};
 u8 fov_alpha[TILES_NUM] = {0};
 
+int fov_caster = FOV_SHADOWCAST;
+
+// tiles seen by the last player fov pass and where it was cast from
+static u64 fov_visible[(TILES_NUM + 63) / 64] = {0};
+static int fov_origin[2] = {-1, -1};
+static int fov_seeing = 0; // current pass is the player's
+static int fov_revision = -1; // level_revision the set was built against
+
+// line batch scratch, too large for the stack, main thread only,
+// the pregen worker never casts fov or chains lightning
+static line_batch_t fov_rays;
+static line_batch_t chain_rays;
+
+int level_revision = 0;
+
 extern entity_t *player;
 
-void entity_new(entity_t **ret, u32 identifier, const char *name)
+// occupancy index, per tile and layer list of entities linked by id
+static entity_t *occupancy[OCCUPANCY_NUM][TILES_NUM] = {{0}};
+static entity_t *occupancy_next[ENTITY_STACK_MAX] = {0};
+static int occupancy_tile[ENTITY_STACK_MAX] = {0};
+static u16 occupancy_count[OCCUPANCY_NUM][TILES_NUM] = {{0}}; // list lengths
+
+// tiles whose entities need redrawing, relit by fov or newly occupied
+static int renderable_dirty[4] = {TILES_X, TILES_Y, -1, -1};
+
+// entities that died outside their own dispatch, for entity_reap
+static entity_handle_t entity_dead[ENTITY_STACK_MAX];
+static int entity_dead_count = 0;
+
+// energy scheduler, a min-heap of entity ids keyed on the turn they next
+// reach ENERGY_MIN. energy is only brought up to date when dispatched
+int schedule_turn = 0;
+static int schedule_heap[ENTITY_STACK_MAX] = {0};
+static int schedule_len = 0;
+static int schedule_slot[ENTITY_STACK_MAX] = {0};
+static int schedule_due[ENTITY_STACK_MAX] = {0};
+static int schedule_stamp[ENTITY_STACK_MAX] = {0};
+
+/*---- COMPONENT SETS ----/
+  One sparse set of entity ids per component, the dense
+  half packs every holder so queries skip empty slots.
+  Filled by the comp_* initializers and emptied again
+  when the entity is removed.
+*/
+typedef struct {
+  u16 dense[ENTITY_STACK_MAX];
+  i16 sparse[ENTITY_STACK_MAX]; // index into dense, -1 if not held
+  int count;
+} comp_set_t;
+
+static comp_set_t comp_sets[COMP_NUM];
+
+void comp_attach(entity_t *e, comp_e comp)
 {
-  for (int i=0; i<ENTITY_STACK_MAX; i++) {
-    if (entity_stack[i] == NULL) {
-      entity_stack[i] = calloc(1, sizeof(entity_t));
-      entity_stack[i]->alive = 1;
-      entity_stack[i]->id    = i;
-      entity_stack[i]->ident = identifier;
-      entity_stack[i]->energy = 0.0f;
-      strcpy(entity_stack[i]->name, name);
-      *ret = entity_stack[i];
-      return;
-    }
+  comp_set_t *set = &comp_sets[comp];
+  if (set->sparse[e->id] >= 0)
+    return;
+
+  set->sparse[e->id] = set->count;
+  set->dense[set->count++] = e->id;
+}
+
+static void comp_detach_all(u32 id)
+{
+  for (int c=0; c<COMP_NUM; c++) {
+    comp_set_t *set = &comp_sets[c];
+    int i = set->sparse[id];
+    if (i < 0)
+      continue;
+
+    u16 last = set->dense[--set->count];
+    set->dense[i] = last;
+    set->sparse[last] = i;
+    set->sparse[id] = -1;
+  }
+}
+
+void entity_query(entity_query_t *q, u32 mask)
+{
+  comp_set_t *driver = NULL;
+  for (int c=0; c<COMP_NUM; c++)
+    if ((mask & COMP_BIT(c)) && (!driver || comp_sets[c].count < driver->count))
+      driver = &comp_sets[c];
+
+  q->mask = mask;
+  q->ids  = driver ? driver->dense : NULL;
+  q->i    = driver ? driver->count : 0;
+}
+
+// walks the dense ids backwards so a swap-remove only moves visited ids
+entity_t *entity_next(entity_query_t *q)
+{
+  while (q->i > 0) {
+    u16 id = q->ids[--q->i];
+    int held = 1;
+    for (int c=0; c<COMP_NUM && held; c++)
+      if (q->mask & COMP_BIT(c))
+        held = comp_sets[c].sparse[id] >= 0;
+
+    if (held)
+      return entity_stack[id];
+  }
+
+  return NULL;
+}
+/*------------------------*/
+
+/*---- STRINGS ----/
+  Names and descriptions are interned once, entities
+  only carry their ids. The table holds pointers to
+  the literals they came from, nothing is copied.
+*/
+#define ENTITY_STRINGS_MAX 256
+
+static const char *entity_strings[ENTITY_STRINGS_MAX] = {""};
+static u16 entity_string_count = 1;
+
+u16 entity_intern(const char *str)
+{
+  if (!str || !str[0])
+    return 0;
+
+  // spawns pass the same literal every time, try the pointer first
+  for (u16 i=1; i<entity_string_count; i++)
+    if (entity_strings[i] == str)
+      return i;
+  for (u16 i=1; i<entity_string_count; i++)
+    if (strcmp(entity_strings[i], str) == 0)
+      return i;
+
+  if (entity_string_count >= ENTITY_STRINGS_MAX) {
+    P_ERR("Entity string table full\n");
+    return 0;
   }
 
+  entity_strings[entity_string_count] = str;
+  return entity_string_count++;
+}
+
+const char *entity_string(u16 id)
+{
+  return id < entity_string_count ? entity_strings[id] : "";
+}
+/*-------------------*/
+
+/*---- POOL ----/
+  Entities live in a fixed slab, free slots are chained
+  through their id field so spawning pops the head. A
+  slot's generation moves on every time it is freed.
+*/
+static entity_t entity_pool[ENTITY_STACK_MAX];
+static u16 entity_generation[ENTITY_STACK_MAX];
+static int entity_free = -1, entity_pool_ready = 0;
+
+void entity_new(entity_t **ret, u32 identifier, const char *name)
+{
+  if (!entity_pool_ready)
+    entity_reset(NULL);
+
   *ret = NULL;
+  if (entity_free < 0)
+    return;
+
+  int i = entity_free;
+  entity_t *e = &entity_pool[i];
+  entity_free = (int)e->id;
+
+  memset(e, 0, sizeof(entity_t));
+  e->alive = 1;
+  e->id    = i;
+  e->ident = identifier;
+  e->energy = 0.0f;
+  e->name = entity_intern(name);
+  occupancy_tile[i] = -1;
+  schedule_slot[i] = -1;
+  schedule_stamp[i] = schedule_turn + 1;
+  entity_stack[i] = e;
+  *ret = e;
+}
+
+static inline void entity_release(int id)
+{
+  comp_detach_all(id);
+  entity_stack[id] = NULL;
+  if (!++entity_generation[id])
+    entity_generation[id] = 1;
+
+  entity_pool[id].id = (u32)entity_free;
+  entity_free = id;
 }
 
 void entity_remove(u32 id)
@@ -35,46 +207,347 @@ void entity_remove(u32 id)
   if (id < ENTITY_STACK_MAX && entity_stack[id]) {
     entity_t *e = entity_stack[id];
 
-    free(entity_stack[id]);
-    entity_stack[id] = NULL;
+    entity_vacate(e);
+    unschedule(e);
+    entity_release(id);
   }
 }
 
-entity_t *entity_get(int x, int y)
+void entity_reset(entity_t *keep)
 {
-  for (int i=0; i<ENTITY_STACK_MAX; i++) {
-    entity_t *e = entity_stack[i];
+  int scheduled = keep && schedule_slot[keep->id] >= 0;
+
+  // drop the indices wholesale instead of unlinking one by one
+  memset(occupancy, 0, sizeof(occupancy));
+  memset(occupancy_next, 0, sizeof(occupancy_next));
+  memset(occupancy_count, 0, sizeof(occupancy_count));
+  schedule_len = 0;
+  entity_dead_count = 0;
+  for (int c=0; c<COMP_NUM; c++) {
+    comp_sets[c].count = 0;
+    memset(comp_sets[c].sparse, -1, sizeof(comp_sets[c].sparse));
+  }
+
+  // rebuild the free list lowest slot first
+  entity_free = -1;
+  for (int i=ENTITY_STACK_MAX-1; i>=0; i--) {
+    occupancy_tile[i] = -1;
+    schedule_slot[i] = -1;
+    if (!entity_pool_ready)
+      entity_generation[i] = 1;
 
-    if (!e || !e->alive || !e->components.position)
+    if (entity_stack[i] && entity_stack[i] == keep)
       continue;
 
-    if (e->position.to[0] == x && e->position.to[1] == y)
-      return e;
+    if (entity_stack[i])
+      entity_release(i);
+    else
+      entity_pool[i].id = (u32)entity_free, entity_free = i;
+  }
+  entity_pool_ready = 1;
+
+  if (keep) {
+    // back into the sets it held, the flags mirror them
+    comp_flags_t f = keep->components;
+    int held[COMP_NUM] = {f.position, f.speed, f.renderable, f.move, f.stats, f.inventory, f.container, f.ai};
+    for (int c=0; c<COMP_NUM; c++)
+      if (held[c])
+        comp_attach(keep, c);
+
+    entity_occupy(keep);
+    if (scheduled)
+      schedule(keep);
+  }
+}
+
+static void entity_bury(entity_t *e)
+{
+  e->alive = 0;
+  entity_vacate(e);
+  if (e->ident != IDENT_PLAYER && entity_dead_count < ENTITY_STACK_MAX)
+    entity_dead[entity_dead_count++] = entity_handle(e);
+}
+
+void entity_reap()
+{
+  // the handle is stale if the dispatch loop got to it first
+  for (int i=0; i<entity_dead_count; i++) {
+    entity_t *e = entity_resolve(entity_dead[i]);
+    if (e && !e->alive)
+      entity_remove(e->id);
   }
+  entity_dead_count = 0;
+}
 
-  return NULL;
+entity_handle_t entity_handle(entity_t *e)
+{
+  if (!e)
+    return ENTITY_HANDLE_NONE;
+
+  return ((u32)entity_generation[e->id] << 16) | e->id;
+}
+
+entity_t *entity_resolve(entity_handle_t handle)
+{
+  u32 id = handle & 0xffff;
+  if (handle == ENTITY_HANDLE_NONE || id >= ENTITY_STACK_MAX)
+    return NULL;
+  if (entity_generation[id] != (handle >> 16))
+    return NULL;
+
+  return entity_stack[id];
+}
+/*--------------*/
+
+static inline void renderable_touch(int x0, int y0, int x1, int y1)
+{
+  renderable_dirty[0] = MIN(renderable_dirty[0], x0);
+  renderable_dirty[1] = MIN(renderable_dirty[1], y0);
+  renderable_dirty[2] = MAX(renderable_dirty[2], x1);
+  renderable_dirty[3] = MAX(renderable_dirty[3], y1);
+}
+
+static inline int occupancy_layer(entity_t *e)
+{
+  return e->ident == IDENT_CONTAINER ? OCCUPANCY_CONTAINER : OCCUPANCY_NPC;
+}
+
+void entity_vacate(entity_t *e)
+{
+  int index = occupancy_tile[e->id];
+  if (index < 0)
+    return;
+
+  int layer = occupancy_layer(e);
+  entity_t **link = &occupancy[layer][index];
+  while (*link && *link != e)
+    link = &occupancy_next[(*link)->id];
+
+  if (*link) {
+    *link = occupancy_next[e->id];
+    occupancy_count[layer][index]--;
+  }
+
+  occupancy_next[e->id] = NULL;
+  occupancy_tile[e->id] = -1;
+}
+
+void entity_occupy(entity_t *e)
+{
+  int x = e->position.to[0], y = e->position.to[1];
+  int index = (y * TILES_X) + x;
+
+  // already indexed on this tile
+  if (occupancy_tile[e->id] == index)
+    return;
+
+  int placed = occupancy_tile[e->id] < 0;
+  entity_vacate(e);
+
+  if (!e->alive || !e->components.position)
+    return;
+
+  if (x < 0 || y < 0 || x >= TILES_X || y >= TILES_Y)
+    return;
+
+  // just placed, nothing has drawn it yet
+  if (placed)
+    renderable_touch(x, y, x, y);
+
+  int layer = occupancy_layer(e);
+  occupancy_next[e->id] = occupancy[layer][index];
+  occupancy[layer][index] = e;
+  occupancy_tile[e->id] = index;
+  occupancy_count[layer][index]++;
+}
+
+static inline entity_t *occupancy_get(int layer, int x, int y)
+{
+  if (x < 0 || y < 0 || x >= TILES_X || y >= TILES_Y)
+    return NULL;
+
+  entity_t *e = occupancy[layer][(y * TILES_X) + x];
+  while (e && !e->alive)
+    e = occupancy_next[e->id];
+
+  return e;
+}
+
+entity_t *entity_get(int x, int y)
+{
+  entity_t *e = occupancy_get(OCCUPANCY_NPC, x, y);
+  if (e)
+    return e;
+
+  return occupancy_get(OCCUPANCY_CONTAINER, x, y);
 }
 
 entity_t *entity_get_npc(int x, int y)
 {
-  for (int i=0; i<ENTITY_STACK_MAX; i++) {
-    entity_t *e = entity_stack[i];
+  return occupancy_get(OCCUPANCY_NPC, x, y);
+}
 
-    if (!e || !e->alive || !e->components.position || (e->ident != IDENT_NPC && e->ident != IDENT_PLAYER))
-      continue;
+entity_t *entity_get_container(int x, int y)
+{
+  return occupancy_get(OCCUPANCY_CONTAINER, x, y);
+}
+
+/*-----------------------------------------/
+/---------------- SCHEDULER ---------------/
+/-----------------------------------------*/
+static inline int schedule_before(int a, int b)
+{
+  if (schedule_due[a] != schedule_due[b])
+    return schedule_due[a] < schedule_due[b];
+
+  return a < b;
+}
 
-    if (e->position.to[0] == x && e->position.to[1] == y)
-      return e;
+static inline void schedule_swap(int i, int j)
+{
+  int a = schedule_heap[i], b = schedule_heap[j];
+  schedule_heap[i] = b; schedule_slot[b] = i;
+  schedule_heap[j] = a; schedule_slot[a] = j;
+}
+
+static void schedule_sift(int i)
+{
+  while (i > 0 && schedule_before(schedule_heap[i], schedule_heap[(i-1)/2])) {
+    schedule_swap(i, (i-1)/2);
+    i = (i-1)/2;
   }
 
-  return NULL;
+  for (;;) {
+    int l = (i*2)+1, r = l+1, m = i;
+    if (l < schedule_len && schedule_before(schedule_heap[l], schedule_heap[m]))
+      m = l;
+    if (r < schedule_len && schedule_before(schedule_heap[r], schedule_heap[m]))
+      m = r;
+    if (m == i)
+      break;
+
+    schedule_swap(i, m);
+    i = m;
+  }
+}
+
+// turns after its stamp until e has the energy to act, -1 if never
+static int schedule_wait(entity_t *e)
+{
+  float speed = e->speed.speed, energy = e->energy;
+  if (energy >= ENERGY_MIN)
+    return 0;
+
+  if (speed <= 0.0f)
+    return -1;
+
+  // same expression as schedule_sync so the float rounding agrees
+  int k = (int)ceilf((ENERGY_MIN - energy) / speed);
+  while (k > 0 && energy + (speed * (k-1)) >= ENERGY_MIN)
+    k--;
+  while (energy + (speed * k) < ENERGY_MIN)
+    k++;
+
+  return k;
+}
+
+void schedule(entity_t *e)
+{
+  int wait = schedule_wait(e);
+  if (wait < 0) {
+    unschedule(e);
+    return;
+  }
+
+  int id = e->id;
+  schedule_due[id] = schedule_stamp[id] + wait;
+  if (schedule_slot[id] < 0) {
+    schedule_slot[id] = schedule_len;
+    schedule_heap[schedule_len++] = id;
+  }
+
+  schedule_sift(schedule_slot[id]);
+}
+
+void unschedule(entity_t *e)
+{
+  int i = schedule_slot[e->id];
+  if (i < 0)
+    return;
+
+  schedule_slot[e->id] = -1;
+  if (i == --schedule_len)
+    return;
+
+  schedule_heap[i] = schedule_heap[schedule_len];
+  schedule_slot[schedule_heap[i]] = i;
+  schedule_sift(i);
+}
+
+// bring e->energy up to the start of turn
+void schedule_sync(entity_t *e, int turn)
+{
+  int k = turn - schedule_stamp[e->id];
+  if (k <= 0)
+    return;
+
+  e->energy = e->energy + (e->speed.speed * k);
+  schedule_stamp[e->id] = turn;
+}
+
+// can e act on the turn after schedule_turn
+int schedule_ready(entity_t *e)
+{
+  return schedule_slot[e->id] >= 0 && schedule_due[e->id] <= schedule_turn + 1;
+}
+
+entity_t *schedule_peek(int *due)
+{
+  if (!schedule_len)
+    return NULL;
+
+  *due = schedule_due[schedule_heap[0]];
+  return entity_stack[schedule_heap[0]];
+}
+
+entity_t *schedule_pop()
+{
+  if (!schedule_len)
+    return NULL;
+
+  entity_t *e = entity_stack[schedule_heap[0]];
+  unschedule(e);
+  return e;
 }
 
 /*-----------------------------------------/
 /---------------- MISC --------------------/
 /-----------------------------------------*/
+/*
+  Multi-source uniform cost wavefront. Every non-wall cell with a value below
+  DIJ_MAX is a seed, seeds are sorted by value and merged with a fifo of
+  relaxed cells so cells are settled in ascending order, each exactly once.
+  This gives the same result as relaxing the whole grid until nothing changes
+  but without the repeated full map sweeps.
+*/
+typedef struct {
+  int value, index;
+} dij_seed_t;
+
+static dij_seed_t dij_seeds[TILES_NUM];
+static int dij_queue[TILES_NUM];
+static u8 dij_settled[TILES_NUM];
+
+static int dij_seed_cmp(const void *a, const void *b)
+{
+  return ((const dij_seed_t*)a)->value - ((const dij_seed_t*)b)->value;
+}
+
 void dijkstra(int *arr, int tox, int toy, int w, int h)
 {
+  if (w * h > TILES_NUM)
+    return;
+
   if (tox >= 0 && toy >= 0 ) {
     for (int y=0; y<h; y++) {
       for (int x=0; x<w; x++) {
@@ -93,42 +566,56 @@ void dijkstra(int *arr, int tox, int toy, int w, int h)
     }
   }
 
-  int changed = 1;
-  while (changed) {
-    changed = 0;
-    for (int y=0; y<h; y++) {
-      for (int x=0; x<w; x++) {
-        int index = (y*w)+x;
-        int tile = arr[index];
-
-        // make sure its a walkable tile
-        if (tile == -(DIJ_MAX+1))
-          continue;
-
-        // find the lowest value surrounding tile
-        int lowest=DIJ_MAX;
-        for (int i=0; i<8; i++) {
-          int tx = MAX(0, MIN((x + around[i][0]), w));
-          int ty = MAX(0, MIN((y + around[i][1]), h));
-          int ti = (ty*w)+tx;
-          if (tx == x && ty == y)
-            continue;
-
-          // make sure its walkable
-          int value = arr[ti];
-          if (value == -(DIJ_MAX+1))
-            continue;
-
-          // is it the lowest value tile?
-          if (value < lowest)
-            lowest = value;
-        }
+  // gather seeds, anything already lower than DIJ_MAX
+  int seed_count = 0;
+  for (int i=0; i<w*h; i++) {
+    dij_settled[i] = 0;
+    if (arr[i] == -(DIJ_MAX+1) || arr[i] >= DIJ_MAX)
+      continue;
 
-        if (lowest < DIJ_MAX && arr[index] > lowest+1) {
-          arr[index] = lowest+1;
-          changed++;
-        }
-      }
+    dij_seeds[seed_count].value = arr[i];
+    dij_seeds[seed_count].index = i;
+    seed_count++;
+  }
+
+  if (seed_count > 1)
+    qsort(dij_seeds, seed_count, sizeof(dij_seed_t), dij_seed_cmp);
+
+  // the fifo only ever holds settled values + 1, so it stays sorted
+  int head = 0, tail = 0, seed = 0;
+  while (seed < seed_count || head < tail) {
+    int index;
+    if (head < tail && (seed >= seed_count || arr[dij_queue[head]] <= dij_seeds[seed].value)) {
+      index = dij_queue[head++];
+    } else {
+      index = dij_seeds[seed].index;
+
+      // lowered by a neighbour since sorting, the fifo has it
+      if (arr[index] != dij_seeds[seed++].value)
+        continue;
+    }
+
+    if (dij_settled[index])
+      continue;
+    dij_settled[index] = 1;
+
+    int value = arr[index] + 1;
+    if (value >= DIJ_MAX)
+      continue;
+
+    int x = index % w, y = index / w;
+    for (int i=0; i<8; i++) {
+      int tx = x + around[i][0];
+      int ty = y + around[i][1];
+      if (tx < 0 || ty < 0 || tx >= w || ty >= h)
+        continue;
+
+      int ti = (ty*w)+tx;
+      if (arr[ti] == -(DIJ_MAX+1) || arr[ti] <= value)
+        continue;
+
+      arr[ti] = value;
+      dij_queue[tail++] = ti;
     }
   }
 }
@@ -158,25 +645,104 @@ int dijkstra_lowest(vec2 out, int *arr, int tilex, int tiley, int w, int h)
   return lowest;
 }
 
+// region of level.tiles[].a touched by the last fov pass
+static int fov_window[4] = {0, 0, TILES_X-1, TILES_Y-1};
+
+// brightness by offset from the viewer, matches the ray caster falloff
+static u8 fov_falloff[FOV_RADIUS+1][FOV_RADIUS+1];
+static int fov_falloff_built = 0;
+
+void fov_reset()
+{
+  fov_window[0] = 0;
+  fov_window[1] = 0;
+  fov_window[2] = TILES_X-1;
+  fov_window[3] = TILES_Y-1;
+}
+
+static inline void fov_see(int x, int y)
+{
+  if (!fov_seeing || x < 0 || y < 0 || x >= TILES_X || y >= TILES_Y)
+    return;
+
+  int index = (y * TILES_X) + x;
+  fov_visible[index >> 6] |= (u64)1 << (index & 63);
+}
+
+// only the player's shadowcasts feed the visibility set, a player
+// ray cast drops it since the fan is not symmetric
+static void fov_begin(entity_t *e, int symmetric)
+{
+  fov_seeing = e == player && symmetric;
+  if (e != player)
+    return;
+
+  memset(fov_visible, 0, sizeof(fov_visible));
+  fov_origin[0] = fov_seeing ? e->position.to[0] : -1;
+  fov_origin[1] = fov_seeing ? e->position.to[1] : -1;
+  fov_revision = level_revision;
+}
+
+int player_fov_covers(int x, int y)
+{
+  if (fov_caster != FOV_SHADOWCAST || fov_revision != level_revision)
+    return 0;
+  if (!player || fov_origin[0] != player->position.to[0] || fov_origin[1] != player->position.to[1])
+    return 0;
+
+  int dx = x - fov_origin[0], dy = y - fov_origin[1];
+  return (dx*dx) + (dy*dy) <= (FOV_RADIUS*FOV_RADIUS) + FOV_RADIUS;
+}
+
+int visible_from_player(int x, int y)
+{
+  if (!player_fov_covers(x, y) || x < 0 || y < 0 || x >= TILES_X || y >= TILES_Y)
+    return 0;
+
+  int index = (y * TILES_X) + x;
+  return (fov_visible[index >> 6] >> (index & 63)) & 1;
+}
+
+int player_distance(int x, int y)
+{
+  if (!player)
+    return DIJ_MAX;
+
+  return MAX(abs(x - player->position.to[0]), abs(y - player->position.to[1]));
+}
+
 void fov(entity_t *e)
+{
+  if (fov_caster == FOV_RAYCAST)
+    fov_raycast(e);
+  else
+    fov_shadowcast(e);
+}
+
+void fov_raycast(entity_t *e)
 {
   for (int i=0; i<TILES_NUM; i++)
     level.tiles[i].a = level_alpha[i];
+  tilesheet_dirty_all(&level);
+  renderable_touch(0, 0, level.w-1, level.h-1);
 
-  int distance = 10;
-  for (double f = 0; f < 3.14*2; f += 0.01) {
-    float fromx = e->position.to[0];
-    float fromy = e->position.to[1];
+  int fromx = e->position.to[0];
+  int fromy = e->position.to[1];
+  fov_begin(e, 0);
 
-    float tox = CLAMP(fromx + 0.5f + ((float)distance * cos(f)), 0, level.w-1);
-    float toy = CLAMP(fromy + 0.5f + ((float)distance * sin(f)), 0, level.h-1);
+  line_batch_init(&fov_rays);
+  for (double f = 0; f < 3.14*2; f += 0.01) {
+    float tox = CLAMP(fromx + 0.5f + (FOV_RADIUS * cos(f)), 0, level.w-1);
+    float toy = CLAMP(fromy + 0.5f + (FOV_RADIUS * sin(f)), 0, level.h-1);
+    line_batch_add(&fov_rays, fromx, fromy, (int)tox, (int)toy);
+  }
 
-    int x = (int)fromx, y = (int)fromy, done = 0, distance = 0;
-    while (!done) {
-      done = line(&x, &y, (int)tox, (int)toy);
-      x = CLAMP(x, 0, level.w-1);
-      y = CLAMP(y, 0, level.h-1);
+  for (int distance=0; line_batch_step(&fov_rays); distance++) {
+    for (int i=0; i<fov_rays.n; i++) {
+      if (!fov_rays.live[i])
+        continue;
 
+      int x = fov_rays.x[i], y = fov_rays.y[i];
       tile_t *tile = &level.tiles[(y*level.w)+x];
       int d = hypot(fromx - x, fromy - y);
       u8 alpha = CLAMP(255 - (distance * d * 2), 0, 255);
@@ -192,13 +758,133 @@ void fov(entity_t *e)
         level_alpha[(ty * level.w) + tx] = 50.0f;
       }
 
-      if (!get_solid(tile->tile) || tile->tile == BLOCK_DOOR || distance > 50) {
-        break;
-      }
+      if (!get_solid(tile->tile) || distance > 50)
+        fov_rays.live[i] = 0;
+    }
+  }
 
-      distance++;
+  fov_reset();
+}
+
+static void fov_build_falloff()
+{
+  for (int dy=0; dy<=FOV_RADIUS; dy++) {
+    for (int dx=0; dx<=FOV_RADIUS; dx++) {
+      // integer sqrt, floor of the euclidean distance
+      int sq = (dx*dx) + (dy*dy), d = 0;
+      while ((d+1) * (d+1) <= sq)
+        d++;
+
+      int steps = MAX(dx, dy) - 1;
+      fov_falloff[dy][dx] = (dx || dy) ? CLAMP(255 - (steps * d * 2), 0, 255) : 255;
     }
   }
+
+  fov_falloff_built = 1;
+}
+
+static inline void fov_light(int x, int y, u8 alpha)
+{
+  if (x < 0 || y < 0 || x >= level.w || y >= level.h)
+    return;
+
+  // brightest of the overlapping reveals wins
+  int index = (y * level.w) + x;
+  if (level.tiles[index].a < alpha) {
+    level.tiles[index].a = alpha;
+    fov_alpha[index] = alpha;
+  }
+  level_alpha[index] = 50.0f;
+}
+
+static inline void fov_reveal(int ox, int oy, int x, int y)
+{
+  int dx = abs(x - ox), dy = abs(y - oy);
+  if ((dx*dx) + (dy*dy) > (FOV_RADIUS*FOV_RADIUS) + FOV_RADIUS)
+    return;
+
+  u8 alpha = fov_falloff[dy][dx];
+  fov_see(x, y);
+  fov_light(x, y, alpha);
+  for (int j=0; j<4; j++)
+    fov_light(x + adjacent[j][0], y + adjacent[j][1], alpha);
+}
+
+static inline int floor_div(int a, int b)
+{
+  return (a >= 0) ? (a / b) : -((-a + b - 1) / b);
+}
+
+// quadrant transforms, depth runs along (dx, dy), columns along (cx, cy)
+static const int fov_quadrant[4][4] = {
+  { 0, -1,  1,  0},
+  { 0,  1,  1,  0},
+  { 1,  0,  0,  1},
+  {-1,  0,  0,  1}
+};
+
+// symmetric shadowcasting, slopes are kept as integer fractions
+static void fov_scan(int ox, int oy, const int *q, int depth, int sn, int sd, int en, int ed)
+{
+  if (depth > FOV_RADIUS)
+    return;
+
+  // columns whose centre lies within the slopes, ties rounded inwards
+  int min_col = floor_div((2 * depth * sn) + sd, 2 * sd);
+  int max_col = -floor_div(ed - (2 * depth * en), 2 * ed);
+
+  int prev = -1;
+  for (int col=min_col; col<=max_col; col++) {
+    int x = ox + (depth * q[0]) + (col * q[2]);
+    int y = oy + (depth * q[1]) + (col * q[3]);
+
+    int wall = 1;
+    if (x >= 0 && y >= 0 && x < level.w && y < level.h)
+      wall = !get_solid(level.tiles[(y * level.w) + x].tile);
+
+    if (wall || (col * sd >= depth * sn && col * ed <= depth * en))
+      fov_reveal(ox, oy, x, y);
+
+    if (prev == 1 && !wall) {
+      sn = (2 * col) - 1;
+      sd = 2 * depth;
+    }
+
+    if (prev == 0 && wall)
+      fov_scan(ox, oy, q, depth+1, sn, sd, (2 * col) - 1, 2 * depth);
+
+    prev = wall;
+  }
+
+  if (prev == 0)
+    fov_scan(ox, oy, q, depth+1, sn, sd, en, ed);
+}
+
+void fov_shadowcast(entity_t *e)
+{
+  if (!fov_falloff_built)
+    fov_build_falloff();
+
+  int ox = e->position.to[0], oy = e->position.to[1];
+  fov_begin(e, 1);
+
+  // only the last lit window needs dimming back to the remembered map
+  renderable_touch(fov_window[0], fov_window[1], fov_window[2], fov_window[3]);
+  for (int y=fov_window[1]; y<=fov_window[3]; y++)
+    for (int x=fov_window[0]; x<=fov_window[2]; x++)
+      level.tiles[(y * level.w) + x].a = level_alpha[(y * level.w) + x];
+  tilesheet_dirty_rect(&level, fov_window[0], fov_window[1], fov_window[2], fov_window[3]);
+
+  fov_window[0] = MAX(ox - FOV_RADIUS - 1, 0);
+  fov_window[1] = MAX(oy - FOV_RADIUS - 1, 0);
+  fov_window[2] = MIN(ox + FOV_RADIUS + 1, level.w-1);
+  fov_window[3] = MIN(oy + FOV_RADIUS + 1, level.h-1);
+  renderable_touch(fov_window[0], fov_window[1], fov_window[2], fov_window[3]);
+  tilesheet_dirty_rect(&level, fov_window[0], fov_window[1], fov_window[2], fov_window[3]);
+
+  fov_reveal(ox, oy, ox, oy);
+  for (int i=0; i<4; i++)
+    fov_scan(ox, oy, fov_quadrant[i], 1, -1, 1, 1, 1);
 }
 
 int inventory_add(entity_t *e, int item, int uses)
@@ -232,8 +918,29 @@ void player_path(entity_t *e)
   fov(e);
 }
 
+// a bag may sit on x, y without stacking or hiding under someone
+static int container_free(int x, int y)
+{
+  if (x < 0 || y < 0 || x >= TILES_X || y >= TILES_Y)
+    return 0;
+
+  int tile = level.tiles[(y * level.w) + x].tile;
+  return tile != BLOCK_DOOR && get_walkable(tile) && !entity_get(x, y);
+}
+
 void container(int item, int uses, int x, int y)
 {
+  // land on a free neighbour instead of stacking, a full inventory
+  // dropped on one tile would otherwise shuffle out a bag per turn
+  if (x >= 0 && y >= 0 && x < TILES_X && y < TILES_Y && occupancy_count[OCCUPANCY_CONTAINER][(y * TILES_X) + x]) {
+    for (int j=0; j<8; j++) {
+      if (container_free(x + around[j][0], y + around[j][1])) {
+        x += around[j][0], y += around[j][1];
+        break;
+      }
+    }
+  }
+
   entity_t *e;
   entity_new(&e, IDENT_CONTAINER, "A BAG");
   comp_container(e, item, uses, x, y);
@@ -241,7 +948,7 @@ void container(int item, int uses, int x, int y)
 
 void setdesc(entity_t *e, const char *desc)
 {
-  strncpy(e->description, desc, MIN(strlen(desc)+1, 128));
+  e->description = entity_intern(desc);
 }
 
 void goblin(int level, int x, int y)
@@ -260,7 +967,7 @@ void goblin(int level, int x, int y)
   if (level < 2) {
     inventory_add(monster, ITEM_GEAR_IRONDAGGER, 1);
   } else if (level < 4) {
-    if (!(rand() % 2))
+    if (!(game_rand(RNG_SPAWN) % 2))
       inventory_add(monster, ITEM_GEAR_IRONDAGGER, 1);
     else
       inventory_add(monster, ITEM_GEAR_IRONSWORD, 1);
@@ -366,7 +1073,7 @@ void blob(int level, int x, int y, int angry)
 
   if (angry) {
     monster->ai.aggro = 1;
-    monster->ai.target = player->id;
+    monster->ai.target = entity_handle(player);
   }
 
   //                ######################|######################|######################|######################|
@@ -395,27 +1102,30 @@ void wizard(int level, int x, int y)
 /*-----------------------------------------/
 /---------------- SYSTEMS -----------------/
 /-----------------------------------------*/
+// e left x, y, draw whoever it was covering
+static void renderable_uncover(entity_t *e, int x, int y)
+{
+  entity_t *under = entity_get(x, y);
+  if (under && under != e)
+    system_renderable(under);
+}
+
 void system_renderable(entity_t *e)
 {
   if (!e->components.renderable || !e->components.position)
     return;
 
   if (e->ident == IDENT_CONTAINER) {
-    for (int i=0; i<ENTITY_STACK_MAX; i++) {
-      entity_t *ent = entity_stack[i];
-      if (!ent || !ent->alive || ent->ident != IDENT_CONTAINER || ent->id == e->id )
-        continue;
-
-      if (ent->position.to[0] != e->position.to[0] || ent->position.to[1] != e->position.to[1])
-        continue;
-
+    // another bag on this tile, shuffle onto a free neighbour
+    int index = occupancy_tile[e->id];
+    if (index >= 0 && occupancy_count[OCCUPANCY_CONTAINER][index] > 1) {
       for (int j=0; j<8; j++) {
         int tx = e->position.to[0] + around[j][0];
         int ty = e->position.to[1] + around[j][1];
-        int tile = level.tiles[(ty * level.w) + tx].tile;
-        if (tile != BLOCK_DOOR && get_walkable(tile) && !entity_get(tx, ty)) {
+        if (container_free(tx, ty)) {
           e->position.to[0] = tx;
           e->position.to[1] = ty;
+          entity_occupy(e);
           break;
         }
       }
@@ -430,12 +1140,20 @@ void system_renderable(entity_t *e)
   }
 
   entity_tiles.tiles[to_index(e->position.from[0], e->position.from[1])].tile = 0;
+  tilesheet_dirty(&entity_tiles, to_index(e->position.from[0], e->position.from[1]));
+  tilesheet_dirty(&entity_tiles, to_index(e->position.to[0], e->position.to[1]));
+
+  int fromx = e->position.from[0], fromy = e->position.from[1];
+  int moved = fromx != e->position.to[0] || fromy != e->position.to[1];
 
   if (!e->alive) {
     entity_tiles.tiles[to_index(e->position.to[0], e->position.to[1])].tile = 0;
+    renderable_uncover(e, e->position.to[0], e->position.to[1]);
+    if (moved)
+      renderable_uncover(e, fromx, fromy);
     return;
   }
-  
+
   tile_t *tile = &entity_tiles.tiles[to_index(e->position.to[0], e->position.to[1])];
   tile->tile = e->renderable.tile;
   tile->r    = e->renderable.rgba[0];
@@ -447,6 +1165,30 @@ void system_renderable(entity_t *e)
 
   e->position.from[0] = e->position.to[0];
   e->position.from[1] = e->position.to[1];
+  if (moved)
+    renderable_uncover(e, fromx, fromy);
+}
+
+void system_renderable_dirty()
+{
+  // spawns during the walk go to the next pass
+  int r[4] = {renderable_dirty[0], renderable_dirty[1], renderable_dirty[2], renderable_dirty[3]};
+  renderable_dirty[0] = TILES_X; renderable_dirty[1] = TILES_Y;
+  renderable_dirty[2] = -1;      renderable_dirty[3] = -1;
+
+  for (int y=MAX(r[1], 0); y<=MIN(r[3], TILES_Y-1); y++) {
+    for (int x=MAX(r[0], 0); x<=MIN(r[2], TILES_X-1); x++) {
+      int index = (y * TILES_X) + x;
+      for (int layer=0; layer<OCCUPANCY_NUM; layer++) {
+        // a bag may shuffle off this tile mid walk
+        entity_t *next;
+        for (entity_t *e = occupancy[layer][index]; e; e = next) {
+          next = occupancy_next[e->id];
+          system_renderable(e);
+        }
+      }
+    }
+  }
 }
 
 void system_move(entity_t *e)
@@ -535,6 +1277,7 @@ void system_move(entity_t *e)
     default: {
       e->position.to[0] = to[0];
       e->position.to[1] = to[1];
+      entity_occupy(e);
       e->energy = 0;
       break;
     }
@@ -544,6 +1287,8 @@ void system_move(entity_t *e)
 void system_energy(entity_t *e)
 {
   e->energy += e->speed.speed;
+  schedule_stamp[e->id] = schedule_turn + 1;
+  schedule(e);
   // if (e->energy > ENERGY_MIN)
     // e->energy = ENERGY_MIN;
 }
@@ -553,8 +1298,10 @@ void system_stats(entity_t *e)
   if (!e->components.stats)
     return;
   
-  if (e->stats.health <= 0)
+  if (e->stats.health <= 0) {
     e->alive = 0;
+    entity_vacate(e);
+  }
 }
 
 void system_inventory(entity_t *e)
@@ -563,18 +1310,7 @@ void system_inventory(entity_t *e)
     return;
 
   if (e->inventory.get > -1) {
-    entity_t *on = NULL;
-    for (int i=0; i<ENTITY_STACK_MAX; i++) {
-      entity_t *ent = entity_stack[i];
-
-      if (!ent || !ent->alive || !ent->components.position)
-        continue;
-
-      if (ent->position.to[0] == e->position.to[0] && ent->position.to[1] == e->position.to[1] && ent->ident == IDENT_CONTAINER) {
-        on = ent;
-        break;
-      }
-    }
+    entity_t *on = entity_get_container(e->position.to[0], e->position.to[1]);
     int ident = on ? on->ident : IDENT_UNKNOWN;
     if (ident == IDENT_CONTAINER) {
       int added = inventory_add(e, on->container.item, on->container.uses);
@@ -582,7 +1318,7 @@ void system_inventory(entity_t *e)
         char buf[128];
         sprintf(buf, "PICKED UP %s", item_info[on->container.item].name);
         ui_popup(e, buf, 255, 255, 120, 255);
-        on->alive = 0;
+        entity_bury(on);
       } else {
         ui_popup(e, "INVENTORY FULL", 255, 255, 120, 255);
       }
@@ -648,7 +1384,7 @@ void system_inventory(entity_t *e)
       -------- */
       switch (item) {
         case ITEM_POTION_HEALING: {
-          e->stats.health = MIN((e->stats.health + (e->stats.max_health/2) + (rand() % 20)), e->stats.max_health);
+          e->stats.health = MIN((e->stats.health + (e->stats.max_health/2) + (game_rand(RNG_COMBAT) % 20)), e->stats.max_health);
           break;
         }
         case ITEM_SCROLL_MAPPING: {
@@ -687,18 +1423,7 @@ void system_inventory(entity_t *e)
 
   if (e->inventory.fire > -1) {
     int item = e->inventory.items[e->inventory.fire];
-    entity_t *entity = NULL;
-    for (int i=0; i<ENTITY_STACK_MAX; i++) {
-      entity_t *ent = entity_stack[i];
-
-      if (!ent || !ent->alive || !ent->components.position)
-        continue;
-
-      if (ent->position.to[0] == e->inventory.fire_x && ent->position.to[1] == e->inventory.fire_y && ent->ident != IDENT_CONTAINER) {
-        entity = ent;
-        break;
-      }
-    }
+    entity_t *entity = entity_get_npc(e->inventory.fire_x, e->inventory.fire_y);
     u32 ident = (entity != NULL) ? entity->ident : IDENT_UNKNOWN;
     if (!entity) // || e->id == entity->id
       ident = IDENT_UNKNOWN;
@@ -707,30 +1432,43 @@ void system_inventory(entity_t *e)
       case IDENT_NPC: {
         action_damage(e, entity, item_info[item].damage);
         if (item == ITEM_WAND_LIGHTNING) {
-          for (int i=0; i<ENTITY_STACK_MAX; i++) {
-            if (e->ident == IDENT_NPC)
-              break;
+          line_batch_t *chain = &chain_rays;
+          entity_t *chained[ENTITY_STACK_MAX];
+
+          line_batch_init(chain);
+          entity_query_t q;
+          entity_query(&q, COMP_BIT(COMP_AI) | COMP_BIT(COMP_POSITION));
+          for (entity_t *ent; e->ident != IDENT_NPC && (ent = entity_next(&q));) {
+            if (!ent->alive || ent->ident != IDENT_NPC)
+              continue;
 
-            entity_t *ent = entity_stack[i];
-            if (!ent || !ent->alive || ent->ident != IDENT_NPC)
+            // the struck npc is always in its own line of sight
+            if (ent == entity) {
+              action_damage(player, ent, item_info[item].damage / 2);
               continue;
+            }
 
-            // see if we have los
-            int sx = entity->position.to[0], sy = entity->position.to[1];
-            int done = 0, distance = 0;
-            while (!done) {
-              done = line(&sx, &sy, ent->position.to[0], ent->position.to[1]);
+            int index = line_batch_add(chain, entity->position.to[0], entity->position.to[1], ent->position.to[0], ent->position.to[1]);
+            if (index >= 0)
+              chained[index] = ent;
+          }
+
+          // see if we have los
+          for (int distance=0; line_batch_step(chain); distance++) {
+            for (int i=0; i<chain->n; i++) {
+              if (!chain->live[i])
+                continue;
+
+              int sx = chain->x[i], sy = chain->y[i];
               if (distance > 10 || !get_solid(level.tiles[(sy*level.w)+sx].tile)) {
-                done = 1;
-                break;
+                chain->live[i] = 0;
+                continue;
               }
-            
-              if (sx == ent->position.to[0] && sy == ent->position.to[1]) {
-                action_damage(player, ent, item_info[item].damage / 2);
-                done = 1;
-                break;
+
+              if (sx == chain->x1[i] && sy == chain->y1[i]) {
+                action_damage(player, chained[i], item_info[item].damage / 2);
+                chain->live[i] = 0;
               }
-              distance++;
             }
           }
         }
@@ -781,34 +1519,39 @@ void system_ai(entity_t *e)
     }
   }
 
-  // if hostile, scan for target
-  int done = 0, found = 0;
+  // if hostile, scan for target, the player's fov answers most of these
+  line_t sight;
   int distance = 0, x = e->position.to[0], y = e->position.to[1];
-  err = 999; err2=999;
   if (e->ai.hostile && !e->ai.aggro) {
-    while (!done) {
-      done = line(&x, &y, player->position.to[0], player->position.to[1]);
-      if (!get_solid(level.tiles[(y*level.w)+x].tile) || distance > 10) {
-        break;
-      }
+    int seen = 0;
+    if (player_fov_covers(x, y)) {
+      seen = visible_from_player(x, y);
+    } else {
+      line_init(&sight, x, y, player->position.to[0], player->position.to[1]);
+      while (line_step(&sight)) {
+        if (!get_solid(level.tiles[(sight.y*level.w)+sight.x].tile) || distance > 10) {
+          break;
+        }
 
-      distance++;
+        distance++;
+      }
+      seen = sight.x == player->position.to[0] && sight.y == player->position.to[1];
     }
-    if (x == player->position.to[0] && y == player->position.to[1]) {
-      e->ai.target = player->id;
+    if (seen) {
+      e->ai.target = entity_handle(player);
       e->ai.aggro = 1;
       char buf[128];
-      sprintf(buf, "THE %s NOTICES YOU", e->name);
+      sprintf(buf, "THE %s NOTICES YOU", entity_string(e->name));
       ui_popup(player, buf, 255, 255, 120, 255);
     }
   }
 
   // do wander
   if (!e->ai.aggro) {
-    int dx = (-1 + (rand() % 3)) + e->position.to[0];
-    int dy = (-1 + (rand() % 3)) + e->position.to[1];
+    int dx = (-1 + (game_rand(RNG_COMBAT) % 3)) + e->position.to[0];
+    int dy = (-1 + (game_rand(RNG_COMBAT) % 3)) + e->position.to[1];
     int tile = level.tiles[(dy * level.w) + dx].tile;
-    if (get_solid(tile) && !(rand() % 2)) {
+    if (get_solid(tile) && !(game_rand(RNG_COMBAT) % 2)) {
       e->move.target[0] = dx;
       e->move.target[1] = dy;
     }
@@ -816,26 +1559,28 @@ void system_ai(entity_t *e)
     return;
   }
 
-  if (e->ai.target < 0)
-    return;
-
-  entity_t *target = entity_stack[e->ai.target];
+  entity_t *target = entity_resolve(e->ai.target);
   if (!target)
     return;
 
-  // see if target is visible
-  done = 0;
-  distance = 0; x = e->position.to[0]; y = e->position.to[1];
-  err = 999; err2=999;
-  while (!done) {
-    done = line(&x, &y, target->position.to[0], target->position.to[1]);
-    if (!get_solid(level.tiles[(y*level.w)+x].tile) || distance > 30) {
-      e->inventory.fire_x = x;
-      e->inventory.fire_x = y;
-      break;
-    }
+  // see if target is visible, npc targets still need a trace
+  distance = 0;
+  if (target == player && player_fov_covers(x, y)) {
+    distance = player_distance(x, y);
+    if (visible_from_player(x, y))
+      x = target->position.to[0], y = target->position.to[1];
+  } else {
+    line_init(&sight, x, y, target->position.to[0], target->position.to[1]);
+    while (line_step(&sight)) {
+      if (!get_solid(level.tiles[(sight.y*level.w)+sight.x].tile) || distance > 30) {
+        e->inventory.fire_x = sight.x;
+        e->inventory.fire_x = sight.y;
+        break;
+      }
 
-    distance++;
+      distance++;
+    }
+    x = sight.x; y = sight.y;
   }
 
   int dist_x = abs(e->position.to[0] - target->position.to[0]);
@@ -847,7 +1592,7 @@ void system_ai(entity_t *e)
     if (e->ai.flees && target->ident == IDENT_PLAYER) {
       e->move.dmap = path_from_player;
 
-      if (dist_x < 2 && dist_y < 2 && !(rand() % 2)) {
+      if (dist_x < 2 && dist_y < 2 && !(game_rand(RNG_COMBAT) % 2)) {
         action_bump(e, target);
         e->energy = 0;
       }
@@ -893,13 +1638,14 @@ void system_ai(entity_t *e)
       projectile.from[1] = e->position.to[1];
       projectile.to[0] = target->position.to[0];
       projectile.to[1] = target->position.to[1];
+      line_init(&projectile.line, projectile.from[0], projectile.from[1], projectile.to[0], projectile.to[1]);
       projectile.tile = 68+8;
       projectile.r = 255;
       projectile.g = 120;
       projectile.b = 255;
       projectile.count = 0;
     } else {
-      if (dist_x < 2 && dist_y < 2 && (item == ITEM_NONE || !(rand() % 6))) { // && e->speed.speed < (target->speed.speed - 0.01f)
+      if (dist_x < 2 && dist_y < 2 && (item == ITEM_NONE || !(game_rand(RNG_COMBAT) % 6))) { // && e->speed.speed < (target->speed.speed - 0.01f)
         // do bump attack
         action_bump(e, target);
         e->energy = 0;
@@ -920,10 +1666,10 @@ void system_ai(entity_t *e)
       e->move.target[0] = e->position.to[0];
       e->move.target[1] = e->position.to[1];
     } else {
-      e->ai.target = -1;
+      e->ai.target = ENTITY_HANDLE_NONE;
       e->ai.aggro = 0;
       char buf[128];
-      sprintf(buf, "THE %s FORGETS ABOUT YOU", e->name);
+      sprintf(buf, "THE %s FORGETS ABOUT YOU", entity_string(e->name));
       ui_popup(player, buf, 255, 255, 120, 255);
     }
   }
@@ -975,15 +1721,18 @@ void action_open(entity_t *e, u32 x, u32 y)
     return;
 
   tile_t *tile = &level.tiles[to_index(x, y)];
+  tilesheet_dirty(&level, to_index(x, y));
   switch (tile->tile) {
     case BLOCK_DOOR: {
       tile->tile = BLOCK_DOOR_OPEN;
       e->energy = 0;;
+      level_revision++;
       break;
     }
     case BLOCK_DOOR_OPEN: {
       tile->tile = BLOCK_DOOR;
       e->energy = 0;;
+      level_revision++;
       break;
     }
   }
@@ -1037,23 +1786,23 @@ void action_damage(entity_t *a, entity_t *b, int damage)
 
   if (b->components.ai) {
     b->ai.aggro  = 1;
-    b->ai.target = a->id;
+    b->ai.target = entity_handle(a);
   }
 
   // print damage
   char buf[128];
   if (b->ident != IDENT_PLAYER) {
-    sprintf(buf, "%s IS HIT FOR %i DAMAGE", b->name, damage);
+    sprintf(buf, "%s IS HIT FOR %i DAMAGE", entity_string(b->name), damage);
     ui_popup(b, buf, 255, 120, 120, 255);
   }
 
   // dead
   if (b->stats.health <= 0) {
-    b->alive = 0;
+    entity_bury(b);
     ui_reset();
     system_renderable(b);
     ui_print("@", b->position.to[0], b->position.to[1], 255, 120, 120, 255);
-    sprintf(buf, "%s DIES", b->name);
+    sprintf(buf, "%s DIES", entity_string(b->name));
     ui_popup(b, buf, 255, 120, 120, 255);
 
     a->stats.exp += b->stats.expmod;
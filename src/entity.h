@@ -2,6 +2,7 @@
 #define ENTITY_H
 
 #define ENTITY_STACK_MAX 512
+#define FOV_RADIUS 10
 
 #include "main.h"
 #include "types.h"
@@ -12,8 +13,42 @@
 extern u8 level_alpha[TILES_NUM];
 extern u8 fov_alpha[TILES_NUM];
 
+typedef enum {
+  FOV_RAYCAST,
+  FOV_SHADOWCAST,
+
+  FOV_NUM
+} fov_e;
+
+extern int fov_caster;
+
+// bumped whenever level tiles change sight lines mid level, doors etc
+extern int level_revision;
+
+/**
+ * [visible_from_player did the last player shadowcast see x, y]
+ * only shadowcast passes fill the set, being symmetric this is also
+ * whether x, y sees the player, the ray caster leaves it unanswered
+ * @return [1 if seen, 0 otherwise, including when not covered]
+ */
+int visible_from_player(int x, int y);
+
+// does the last player shadowcast have a current answer for x, y, no
+// when the ray caster is selected, the player moved or level_revision
+// changed since
+int player_fov_covers(int x, int y);
+
+// steps a line trace takes between the player and x, y
+int player_distance(int x, int y);
+
+// slot id in the low 16 bits and the slot generation above, a handle
+// stops resolving once its entity is removed and the slot reused
+typedef u32 entity_handle_t;
+#define ENTITY_HANDLE_NONE 0
+
 typedef struct comp_ai_t {
-  int aggro, target, hostile;
+  entity_handle_t target;
+  int aggro, hostile;
   int dumb, splitter, flees;
 } comp_ai_t;
 
@@ -55,6 +90,22 @@ typedef struct comp_move_t {
   int w, h;
 } comp_move_t;
 
+// component ids, bit n of a query mask asks for component n
+typedef enum {
+  COMP_POSITION,
+  COMP_SPEED,
+  COMP_RENDERABLE,
+  COMP_MOVE,
+  COMP_STATS,
+  COMP_INVENTORY,
+  COMP_CONTAINER,
+  COMP_AI,
+
+  COMP_NUM
+} comp_e;
+
+#define COMP_BIT(c) (1u << (c))
+
 typedef struct {
   u32 position   : 1;
   u32 speed      : 1;
@@ -70,7 +121,7 @@ typedef struct {
   u32 id, ident;
   int alive;
   float energy;
-  char name[64], description[128];
+  u16 name, description; // ids into the string table
 
   // components we can have
   comp_flags_t      components;
@@ -88,14 +139,48 @@ typedef struct {
 
 extern entity_t *entity_stack[ENTITY_STACK_MAX];
 
+// per-tile occupancy layers
+typedef enum {
+  OCCUPANCY_NPC,
+  OCCUPANCY_CONTAINER,
+
+  OCCUPANCY_NUM
+} occupancy_e;
+
+void entity_occupy(entity_t *e);
+void entity_vacate(entity_t *e);
+
+// turn currently being dispatched by the scheduler
+extern int schedule_turn;
+
+void schedule(entity_t *e);
+void unschedule(entity_t *e);
+
+// add e to the sparse set of comp, the comp_* initializers call this
+void comp_attach(entity_t *e, comp_e comp);
+
+// walk of every entity holding all components in a mask, the
+// smallest set drives it, removing the current entity is safe
+typedef struct {
+  u32 mask;
+  const u16 *ids;
+  int i;
+} entity_query_t;
+
+void entity_query(entity_query_t *q, u32 mask);
+entity_t *entity_next(entity_query_t *q);
+
 // component initializers
 static void comp_position(entity_t *e, u32 x, u32 y) {
   e->components.position = 1;
+  comp_attach(e, COMP_POSITION);
   e->position.from[0] = x; e->position.from[1] = y;
   e->position.to[0] = x; e->position.to[1] = y;
+  entity_occupy(e);
 }
 static void comp_renderable(entity_t *e, u32 tile, u8 r, u8 g, u8 b, u8 a) {
   e->components.renderable = 1;
+  comp_attach(e, COMP_RENDERABLE);
   e->renderable.tile = tile;
   e->renderable.rgba[0] = r;
   e->renderable.rgba[1] = g;
@@ -104,16 +189,20 @@ static void comp_renderable(entity_t *e, u32 tile, u8 r, u8 g, u8 b, u8 a) {
 }
 static void comp_speed(entity_t *e, float speed) {
   e->components.speed = 1;
+  comp_attach(e, COMP_SPEED);
   e->speed.speed = speed;
+  schedule(e);
 }
 static void comp_move(entity_t *e) {
   e->components.move = 1;
+  comp_attach(e, COMP_MOVE);
   e->move.target[0] = e->position.to[0];
   e->move.target[1] = e->position.to[1];
   e->move.dmap = NULL;
 }
 static void comp_stats(entity_t *e, int health, int level, int base_damage) {
   e->components.stats = 1;
+  comp_attach(e, COMP_STATS);
   e->stats.health = health;
   e->stats.max_health = health;
   e->stats.level = level;
@@ -123,6 +212,7 @@ static void comp_stats(entity_t *e, int health, int level, int base_damage) {
 static void comp_inventory(entity_t *e)
 {
   e->components.inventory = 1;
+  comp_attach(e, COMP_INVENTORY);
   memset(e->inventory.items, ITEM_NONE, sizeof(int) * INVENTORY_MAX);
   memset(e->inventory.uses, 0, sizeof(int) * INVENTORY_MAX);
   memset(e->inventory.equipt, 0, sizeof(int) * INVENTORY_MAX);
@@ -151,20 +241,53 @@ static void comp_container(entity_t *e, int item, int uses, int x, int y)
   comp_renderable(e, tile, 255, 120, 255, 255);
   comp_position(e, x, y);
   e->components.container = 1;
+  comp_attach(e, COMP_CONTAINER);
   e->container.item = item;
   e->container.uses = uses;
 }
 static void comp_ai(entity_t *e)
 {
   e->components.ai = 1;
+  comp_attach(e, COMP_AI);
   memset(&e->ai, 0, sizeof(comp_ai_t));
-  e->ai.target = -1;
+  e->ai.target = ENTITY_HANDLE_NONE;
 }
 
+/**
+ * [entity_intern id for a string, equal strings share one id]
+ * @param  str [text, kept by pointer so it must outlive the game]
+ * @return     [id, 0 is the empty string]
+ */
+u16 entity_intern(const char *str);
+
+// text behind an interned id
+const char *entity_string(u16 id);
+
 void entity_new(entity_t **ret, u32 identifier, const char *name);
 void entity_remove(u32 id);
+
+/**
+ * [entity_reset remove every entity at once]
+ * @param keep [entity to leave in place, or NULL]
+ */
+void entity_reset(entity_t *keep);
+
+entity_handle_t entity_handle(entity_t *e);
+
+// remove entities killed outside their own dispatch
+void entity_reap();
+
+// NULL once the entity behind the handle is gone
+entity_t *entity_resolve(entity_handle_t handle);
+
 entity_t *entity_get(int x, int y);
 entity_t *entity_get_npc(int x, int y);
+entity_t *entity_get_container(int x, int y);
+
+void schedule_sync(entity_t *e, int turn);
+int schedule_ready(entity_t *e);
+entity_t *schedule_peek(int *due);
+entity_t *schedule_pop();
 
 
 void dijkstra(int *arr, int tox, int toy, int w, int h);
@@ -173,6 +296,9 @@ int inventory_add(entity_t *e, int item, int uses);
 void player_path(entity_t *e);
 void container(int item, int uses, int x, int y);
 void fov(entity_t *e);
+void fov_raycast(entity_t *e);
+void fov_shadowcast(entity_t *e);
+void fov_reset();
 
 void goblin(int level, int x, int y);
 void goblin_caster(int level, int x, int y);
@@ -184,6 +310,8 @@ void wizard(int level, int x, int y);
 
 void system_move(entity_t *e);
 void system_renderable(entity_t *e);
+// redraw entities on tiles relit by fov or newly occupied
+void system_renderable_dirty();
 void system_energy(entity_t *e);
 void system_stats(entity_t *e);
 void system_inventory(entity_t *e);
@@ -1,4 +1,3 @@
-#include <time.h>
 #include "game.h"
 #include "gen.h"
 #include "entity.h"
@@ -24,7 +23,6 @@ int paused = 0;
 double projectile_timer = 0;
 projectile_t projectile = {0};
 
-int entity_index = 0;
 
 int use_item = 0;
 int tile_on = 0;
@@ -32,6 +30,8 @@ int locked = 1;
 
 int aim_x = 0, aim_y = 0;
 
+rng_t game_rng[RNG_NUM];
+
 void (*direction_action)(entity_t*, u32, u32) = NULL;
 
 // keybinds with associated action
@@ -40,6 +40,22 @@ keybind_t keybinds[SDL_NUM_SCANCODES] = {0};
 // visible tile maps
 tilesheet_packet_t level = {NULL}, entity_tiles = {NULL};
 
+/*---- PREGEN ----/
+  The next level is generated on a worker as soon as
+  a level loads, the stairs then only copy it in. Only
+  one gen() may run at a time, so everything else that
+  wants a level waits for the worker first.
+*/
+typedef struct {
+  tile_t tiles[TILES_NUM];
+  int depth, ready;
+  rng_t rng;
+  int spawn_x, spawn_y; // player start
+} pregen_t;
+
+static pregen_t pregen = {0};
+static void *pregen_thread = NULL;
+
 int dungeon_depth = 0;
 
 // player stuff
@@ -79,6 +95,7 @@ void projectile_start(int fromx, int fromy, int tox, int toy, int t)
   projectile.from[1] = fromy;
   projectile.to[0] = tox;
   projectile.to[1] = toy;
+  line_init(&projectile.line, fromx, fromy, tox, toy);
   projectile.tile = t;
   projectile.r = 255;
   projectile.g = 255;
@@ -91,6 +108,7 @@ void projectile_start(int fromx, int fromy, int tox, int toy, int t)
   tile->g    = projectile.g;
   tile->b    = projectile.b;
   tile->a    = 255;
+  tilesheet_dirty(&entity_tiles, to_index(projectile.from[0], projectile.from[1]));
 
   projectile_timer = PROJECTILE_SPEED;
 }
@@ -105,8 +123,11 @@ int projectile_run()
 
     tile_t *tile = &ui_tiles.tiles[to_index(p->from[0], p->from[1])];
     tile->tile   = 0;
+    tilesheet_dirty(&ui_tiles, to_index(p->from[0], p->from[1]));
 
-    line(&(p->from[0]), &(p->from[1]), p->to[0], p->to[1]);
+    line_step(&p->line);
+    p->from[0] = p->line.x;
+    p->from[1] = p->line.y;
 
     tile       = &ui_tiles.tiles[to_index(p->from[0], p->from[1])];
     tile->tile = p->tile;
@@ -114,6 +135,7 @@ int projectile_run()
     tile->g    = p->g;
     tile->b    = p->b;
     tile->a    = 255;
+    tilesheet_dirty(&ui_tiles, to_index(p->from[0], p->from[1]));
 
     if ((p->from[0] == p->to[0] && p->from[1] == p->to[1]) || p->count > 50) {
       ui_tiles.tiles[to_index(p->from[0], p->from[1])].tile = 0;
@@ -133,24 +155,22 @@ void place_entity(int ent, int lvl, int number)
 {
   for (int num=0; num<number; num++) {
     for (int a=0; a<1000; a++) {
-      int tx = rand() % TILES_X;
-      int ty = rand() % TILES_Y;
+      int tx = game_rand(RNG_SPAWN) % TILES_X;
+      int ty = game_rand(RNG_SPAWN) % TILES_Y;
       int tile = level.tiles[(ty * level.w) + tx].tile;
       if (tile != BLOCK_FLOOR && tile != BLOCK_FLOOR+1)
         continue;
 
-      int sx = tx, sy = ty;
-      int done = 0, distance = 0;
-      while (!done) {
-        done = line(&sx, &sy, player->position.to[0], player->position.to[1]);
-        if (distance > 50 || !get_solid(level.tiles[(sy*level.w)+sx].tile) || entity_get_npc(sx, sy)) {
-          done = 1;
+      line_t sight;
+      int distance = 0;
+      line_init(&sight, tx, ty, player->position.to[0], player->position.to[1]);
+      while (line_step(&sight)) {
+        if (distance > 50 || !get_solid(level.tiles[(sight.y*level.w)+sight.x].tile) || entity_get_npc(sight.x, sight.y))
           break;
-        }
         distance++;
       }
 
-      if ((sx != player->position.to[0] || sy != player->position.to[1])) {
+      if ((sight.x != player->position.to[0] || sight.y != player->position.to[1])) {
         switch (ent) {
           case ENTITY_GOBLIN: {
             goblin(lvl, tx, ty);
@@ -192,8 +212,8 @@ void place_container(int item, int uses, int number)
 {
   for (int num=0; num<number; num++) {
     for (int i=0; i<100; i++) {
-      int tx = rand() % TILES_X;
-      int ty = rand() % TILES_Y;
+      int tx = game_rand(RNG_SPAWN) % TILES_X;
+      int ty = game_rand(RNG_SPAWN) % TILES_Y;
       int tile = level.tiles[(ty * level.w) + tx].tile;
       if (tile != BLOCK_FLOOR && tile != BLOCK_FLOOR+1)
         continue;
@@ -204,16 +224,55 @@ void place_container(int item, int uses, int number)
   }
 }
 
-void generate_dungeon(int depth, int reset)
+static int pregen_run(void *data)
 {
-  for (int i=1; i<ENTITY_STACK_MAX; i++) {
-    entity_t *e = entity_stack[i];
-    if (e) {
-      entity_remove(i);
-      entity_stack[i] = NULL;
-    }
+  pregen_t *p = data;
+  gen(p->tiles, p->depth, &p->rng);
+
+  int tile = 0;
+  while (tile != BLOCK_FLOOR) {
+    p->spawn_x = rng_rand(&p->rng) % TILES_X;
+    p->spawn_y = rng_rand(&p->rng) % TILES_Y;
+    tile = p->tiles[(p->spawn_y * TILES_X) + p->spawn_x].tile;
   }
 
+  p->ready = 1;
+  return 0;
+}
+
+// seeded from RNG_GEN on the calling thread, the worker never touches it
+static void pregen_seed(int depth)
+{
+  pregen.depth = depth;
+  pregen.ready = 0;
+  // separate statements, argument order would be up to the compiler
+  u64 hi = rng_next(&game_rng[RNG_GEN]);
+  u64 lo = rng_next(&game_rng[RNG_GEN]);
+  u64 seed = (hi << 32) | lo;
+  rng_seed(&pregen.rng, seed, depth);
+}
+
+static void pregen_start(int depth)
+{
+  pregen_seed(depth);
+  pregen_thread = render_thread(pregen_run, "pregen", &pregen);
+}
+
+// wait for the worker, 1 if it left a level for depth behind
+static int pregen_take(int depth)
+{
+  render_thread_wait(pregen_thread);
+  pregen_thread = NULL;
+  return pregen.ready && pregen.depth == depth;
+}
+
+void generate_dungeon(int depth, int reset)
+{
+  // everything but the player goes, the player too on a new game
+  entity_reset(reset ? NULL : player);
+  if (reset)
+    player = NULL;
+
   magic_mapping = 0;
 
   // initialize the player entity
@@ -221,8 +280,6 @@ void generate_dungeon(int depth, int reset)
     // initialize the item db
     db();
 
-    if (player)
-      entity_remove(player->id);
     entity_new(&player, IDENT_PLAYER, "PLAYER");
     comp_renderable(player, 38, 255, 255, 255, 255);
     comp_speed(player, 0.5f);
@@ -231,167 +288,183 @@ void generate_dungeon(int depth, int reset)
     inventory_add(player, ITEM_WAND_IDENTIFY, 100);
     inventory_add(player, ITEM_POTION_HEALING, 1);
 
-    strcpy(player->description, "YOURSELF. NOT OVERLY   INTELLIGENT AND RATHER FEEBLE");
+    player->description = entity_intern("YOURSELF. NOT OVERLY   INTELLIGENT AND RATHER FEEBLE");
 
     ui_state = UI_STATE_MENU;
   }
 
-  memset(level.tiles, 0, sizeof(tile_t) * level.w * level.h);
   memset(ui_tiles.tiles, 0, sizeof(tile_t) * ui_tiles.w * ui_tiles.h);
   memset(entity_tiles.tiles, 0, sizeof(tile_t) * entity_tiles.w * entity_tiles.h);
+  tilesheet_dirty_all(&level);
+  tilesheet_dirty_all(&ui_tiles);
+  tilesheet_dirty_all(&entity_tiles);
   memset(level_alpha, 0, TILES_NUM);
   memset(fov_alpha, 0, TILES_NUM);
 
-  // generate the dungeon
-  gen(&level, dungeon_depth);
+  // generate the dungeon, usually the worker already has
+  if (!pregen_take(dungeon_depth)) {
+    pregen_seed(dungeon_depth);
+    pregen_run(&pregen);
+  }
+  memcpy(level.tiles, pregen.tiles, sizeof(tile_t) * TILES_NUM);
+  level_revision++;
+  pregen.ready = 0;
+  fov_reset();
 
   // move the player into position
-  int x, y;
-  int tile = 0;
-  while (tile != BLOCK_FLOOR) {
-    x = rand() % level.w;
-    y = rand() % level.h;
-    tile = level.tiles[(y * level.w) + x].tile;
-  }
-  comp_position(player, x, y);
+  comp_position(player, pregen.spawn_x, pregen.spawn_y);
   comp_move(player);
   fov(player);
   system_renderable(player);
 
   switch(dungeon_depth) {
     case 0: {
-      place_entity(ENTITY_GOBLIN, 1 + (rand() % 2), 4 + (rand() % 3));
-      place_entity(ENTITY_GOBLIN_CASTER, 1, 2 + (rand() % 2));
-      place_entity(ENTITY_BAT, 1, 4 + (rand() % 4));
-      place_entity(ENTITY_JACKEL, 1, 2 + (rand() % 4));
+      place_entity(ENTITY_GOBLIN, 1 + (game_rand(RNG_SPAWN) % 2), 4 + (game_rand(RNG_SPAWN) % 3));
+      place_entity(ENTITY_GOBLIN_CASTER, 1, 2 + (game_rand(RNG_SPAWN) % 2));
+      place_entity(ENTITY_BAT, 1, 4 + (game_rand(RNG_SPAWN) % 4));
+      place_entity(ENTITY_JACKEL, 1, 2 + (game_rand(RNG_SPAWN) % 4));
       place_container(ITEM_POTION_HEALING, 1, 2);
       place_container(ITEM_SCROLL_MAPPING, 1, 1);
-      if (!(rand() % 10)) place_container(ITEM_GEAR_CHAINHELM, 1, 1);
-      if (!(rand() % 10)) place_container(ITEM_GEAR_CHAINCHEST, 1, 1);
-      if (!(rand() % 10)) place_container(ITEM_GEAR_CHAINLEGS, 1, 1);
-      if (!(rand() % 10)) place_container(ITEM_GEAR_IRONBOOTS, 1, 1);
-      if (!(rand() % 10)) place_container(ITEM_GEAR_GLOVES, 1, 1);
-      if (!(rand() % 10)) place_container(ITEM_GEAR_ARMS, 1, 1);
-      if (!(rand() % 10)) place_container(ITEM_GEAR_SHIELD, 1, 1);
-      if (!(rand() % 10)) place_container(ITEM_GEAR_IRONDAGGER, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 10)) place_container(ITEM_GEAR_CHAINHELM, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 10)) place_container(ITEM_GEAR_CHAINCHEST, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 10)) place_container(ITEM_GEAR_CHAINLEGS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 10)) place_container(ITEM_GEAR_IRONBOOTS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 10)) place_container(ITEM_GEAR_GLOVES, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 10)) place_container(ITEM_GEAR_ARMS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 10)) place_container(ITEM_GEAR_SHIELD, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 10)) place_container(ITEM_GEAR_IRONDAGGER, 1, 1);
       break;
     }
     case 1: {
-      place_entity(ENTITY_GOBLIN, 2 + (rand() % 2), 5 + (rand() % 3));
-      place_entity(ENTITY_GOBLIN_CASTER, 2, 2 + (rand() % 2));
-      place_entity(ENTITY_BAT, 2, 5 + (rand() % 4));
-      place_entity(ENTITY_JACKEL, 2, 4 + (rand() % 4));
-      place_entity(ENTITY_ZOMBIE, 2, 1 + (rand() % 2));
+      place_entity(ENTITY_GOBLIN, 2 + (game_rand(RNG_SPAWN) % 2), 5 + (game_rand(RNG_SPAWN) % 3));
+      place_entity(ENTITY_GOBLIN_CASTER, 2, 2 + (game_rand(RNG_SPAWN) % 2));
+      place_entity(ENTITY_BAT, 2, 5 + (game_rand(RNG_SPAWN) % 4));
+      place_entity(ENTITY_JACKEL, 2, 4 + (game_rand(RNG_SPAWN) % 4));
+      place_entity(ENTITY_ZOMBIE, 2, 1 + (game_rand(RNG_SPAWN) % 2));
       place_entity(ENTITY_BLOB, 2, 2);
       place_container(ITEM_POTION_HEALING, 1, 3);
       place_container(ITEM_SCROLL_MAPPING, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_WAND_FIREBOLT, 5, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_CHAINHELM, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_CHAINCHEST, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_CHAINLEGS, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_IRONBOOTS, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_GLOVES, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_ARMS, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_SHIELD, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_IRONDAGGER, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_IRONSWORD, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_WAND_FIREBOLT, 5, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_CHAINHELM, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_CHAINCHEST, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_CHAINLEGS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_IRONBOOTS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_GLOVES, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_ARMS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_SHIELD, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_IRONDAGGER, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_IRONSWORD, 1, 1);
       break;
     }
     case 2: {
-      place_entity(ENTITY_GOBLIN, 3 + (rand() % 2), 5 + (rand() % 3));
-      place_entity(ENTITY_GOBLIN_CASTER, 3, 2 + (rand() % 2));
-      place_entity(ENTITY_BAT, 3, 5 + (rand() % 4));
-      place_entity(ENTITY_JACKEL, 3, 5 + (rand() % 4));
-      place_entity(ENTITY_ZOMBIE, 3, 1 + (rand() % 2));
-      place_entity(ENTITY_BLOB, 3, 3 + (rand() % 2));
+      place_entity(ENTITY_GOBLIN, 3 + (game_rand(RNG_SPAWN) % 2), 5 + (game_rand(RNG_SPAWN) % 3));
+      place_entity(ENTITY_GOBLIN_CASTER, 3, 2 + (game_rand(RNG_SPAWN) % 2));
+      place_entity(ENTITY_BAT, 3, 5 + (game_rand(RNG_SPAWN) % 4));
+      place_entity(ENTITY_JACKEL, 3, 5 + (game_rand(RNG_SPAWN) % 4));
+      place_entity(ENTITY_ZOMBIE, 3, 1 + (game_rand(RNG_SPAWN) % 2));
+      place_entity(ENTITY_BLOB, 3, 3 + (game_rand(RNG_SPAWN) % 2));
       place_container(ITEM_POTION_HEALING, 1, 2);
       place_container(ITEM_SCROLL_MAPPING, 1, 1);
-      if (!(rand() % 4)) place_container(ITEM_WAND_FIREBOLT, 5, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_CHAINHELM, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_CHAINCHEST, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_CHAINLEGS, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_IRONBOOTS, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_GLOVES, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_ARMS, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_SHIELD, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_IRONDAGGER, 1, 1);
-      if (!(rand() % 8)) place_container(ITEM_GEAR_IRONSWORD, 1, 1);
-      if (!(rand() % 15)) place_container(ITEM_GEAR_GREATSWORD, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 4)) place_container(ITEM_WAND_FIREBOLT, 5, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_CHAINHELM, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_CHAINCHEST, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_CHAINLEGS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_IRONBOOTS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_GLOVES, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_ARMS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_SHIELD, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_IRONDAGGER, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 8)) place_container(ITEM_GEAR_IRONSWORD, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 15)) place_container(ITEM_GEAR_GREATSWORD, 1, 1);
       break;
     }
     case 3: {
-      place_entity(ENTITY_GOBLIN, 4 + (rand() % 2), 3 + (rand() % 3));
-      place_entity(ENTITY_GOBLIN_CASTER, 4 + (rand() % 2), 2 + (rand() % 2));
-      place_entity(ENTITY_BAT, 4 + (rand() % 2), 6 + (rand() % 4));
-      place_entity(ENTITY_JACKEL, 4 + (rand() % 2), 6 + (rand() % 4));
-      place_entity(ENTITY_ZOMBIE, 4 + (rand() % 2), 4 + (rand() % 2));
-      place_entity(ENTITY_BLOB, 4 + (rand() % 2), 8 + (rand() % 4));
+      place_entity(ENTITY_GOBLIN, 4 + (game_rand(RNG_SPAWN) % 2), 3 + (game_rand(RNG_SPAWN) % 3));
+      place_entity(ENTITY_GOBLIN_CASTER, 4 + (game_rand(RNG_SPAWN) % 2), 2 + (game_rand(RNG_SPAWN) % 2));
+      place_entity(ENTITY_BAT, 4 + (game_rand(RNG_SPAWN) % 2), 6 + (game_rand(RNG_SPAWN) % 4));
+      place_entity(ENTITY_JACKEL, 4 + (game_rand(RNG_SPAWN) % 2), 6 + (game_rand(RNG_SPAWN) % 4));
+      place_entity(ENTITY_ZOMBIE, 4 + (game_rand(RNG_SPAWN) % 2), 4 + (game_rand(RNG_SPAWN) % 2));
+      place_entity(ENTITY_BLOB, 4 + (game_rand(RNG_SPAWN) % 2), 8 + (game_rand(RNG_SPAWN) % 4));
       place_container(ITEM_POTION_HEALING, 1, 2);
-      if (!(rand() % 2)) place_container(ITEM_WAND_FIREBOLT, 5, 1);
-      if (!(rand() % 2)) place_container(ITEM_POTION_HEALING, 1, 2);
-      if (!(rand() % 5)) place_container(ITEM_SCROLL_MAPPING, 1, 1);
-      if (!(rand() % 5)) place_container(ITEM_GEAR_CHAINHELM, 1, 1);
-      if (!(rand() % 5)) place_container(ITEM_GEAR_CHAINCHEST, 1, 1);
-      if (!(rand() % 5)) place_container(ITEM_GEAR_CHAINLEGS, 1, 1);
-      if (!(rand() % 5)) place_container(ITEM_GEAR_IRONBOOTS, 1, 1);
-      if (!(rand() % 5)) place_container(ITEM_GEAR_GLOVES, 1, 1);
-      if (!(rand() % 5)) place_container(ITEM_GEAR_ARMS, 1, 1);
-      if (!(rand() % 5)) place_container(ITEM_GEAR_SHIELD, 1, 1);
-      if (!(rand() % 5)) place_container(ITEM_GEAR_IRONDAGGER, 1, 1);
-      if (!(rand() % 5)) place_container(ITEM_GEAR_IRONSWORD, 1, 1);
-      if (!(rand() % 5)) place_container(ITEM_GEAR_GREATSWORD, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 2)) place_container(ITEM_WAND_FIREBOLT, 5, 1);
+      if (!(game_rand(RNG_SPAWN) % 2)) place_container(ITEM_POTION_HEALING, 1, 2);
+      if (!(game_rand(RNG_SPAWN) % 5)) place_container(ITEM_SCROLL_MAPPING, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 5)) place_container(ITEM_GEAR_CHAINHELM, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 5)) place_container(ITEM_GEAR_CHAINCHEST, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 5)) place_container(ITEM_GEAR_CHAINLEGS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 5)) place_container(ITEM_GEAR_IRONBOOTS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 5)) place_container(ITEM_GEAR_GLOVES, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 5)) place_container(ITEM_GEAR_ARMS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 5)) place_container(ITEM_GEAR_SHIELD, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 5)) place_container(ITEM_GEAR_IRONDAGGER, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 5)) place_container(ITEM_GEAR_IRONSWORD, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 5)) place_container(ITEM_GEAR_GREATSWORD, 1, 1);
       break;
     }
     case 4: {
-      place_entity(ENTITY_GOBLIN, 5 + (rand() % 2), 3 + (rand() % 3));
-      place_entity(ENTITY_GOBLIN_CASTER, 5 + (rand() % 2), 4 + (rand() % 2));
-      place_entity(ENTITY_BAT, 5 + (rand() % 2), 6 + (rand() % 4));
-      place_entity(ENTITY_JACKEL, 5 + (rand() % 2), 6 + (rand() % 4));
-      place_entity(ENTITY_ZOMBIE, 5 + (rand() % 2), 4 + (rand() % 4));
-      place_entity(ENTITY_BLOB, 5 + (rand() % 2), 12 + (rand() % 6));
-      place_entity(ENTITY_WIZARD, 6 + (rand() % 2), 2 + (rand() % 2));
-      if (!(rand() % 5)) place_container(ITEM_POTION_HEALING, 1, 2);
-      if (!(rand() % 2)) place_container(ITEM_SCROLL_MAPPING, 1, 1);
-      if (!(rand() % 2)) place_container(ITEM_GEAR_CHAINHELM, 1, 1);
-      if (!(rand() % 2)) place_container(ITEM_GEAR_CHAINCHEST, 1, 1);
-      if (!(rand() % 2)) place_container(ITEM_GEAR_CHAINLEGS, 1, 1);
-      if (!(rand() % 2)) place_container(ITEM_GEAR_IRONBOOTS, 1, 1);
-      if (!(rand() % 2)) place_container(ITEM_GEAR_GLOVES, 1, 1);
-      if (!(rand() % 2)) place_container(ITEM_GEAR_ARMS, 1, 1);
-      if (!(rand() % 2)) place_container(ITEM_GEAR_SHIELD, 1, 1);
-      if (!(rand() % 2)) place_container(ITEM_GEAR_IRONDAGGER, 1, 1);
-      if (!(rand() % 2)) place_container(ITEM_GEAR_IRONSWORD, 1, 1);
-      if (!(rand() % 2)) place_container(ITEM_GEAR_GREATSWORD, 1, 1);
+      place_entity(ENTITY_GOBLIN, 5 + (game_rand(RNG_SPAWN) % 2), 3 + (game_rand(RNG_SPAWN) % 3));
+      place_entity(ENTITY_GOBLIN_CASTER, 5 + (game_rand(RNG_SPAWN) % 2), 4 + (game_rand(RNG_SPAWN) % 2));
+      place_entity(ENTITY_BAT, 5 + (game_rand(RNG_SPAWN) % 2), 6 + (game_rand(RNG_SPAWN) % 4));
+      place_entity(ENTITY_JACKEL, 5 + (game_rand(RNG_SPAWN) % 2), 6 + (game_rand(RNG_SPAWN) % 4));
+      place_entity(ENTITY_ZOMBIE, 5 + (game_rand(RNG_SPAWN) % 2), 4 + (game_rand(RNG_SPAWN) % 4));
+      place_entity(ENTITY_BLOB, 5 + (game_rand(RNG_SPAWN) % 2), 12 + (game_rand(RNG_SPAWN) % 6));
+      place_entity(ENTITY_WIZARD, 6 + (game_rand(RNG_SPAWN) % 2), 2 + (game_rand(RNG_SPAWN) % 2));
+      if (!(game_rand(RNG_SPAWN) % 5)) place_container(ITEM_POTION_HEALING, 1, 2);
+      if (!(game_rand(RNG_SPAWN) % 2)) place_container(ITEM_SCROLL_MAPPING, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 2)) place_container(ITEM_GEAR_CHAINHELM, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 2)) place_container(ITEM_GEAR_CHAINCHEST, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 2)) place_container(ITEM_GEAR_CHAINLEGS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 2)) place_container(ITEM_GEAR_IRONBOOTS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 2)) place_container(ITEM_GEAR_GLOVES, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 2)) place_container(ITEM_GEAR_ARMS, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 2)) place_container(ITEM_GEAR_SHIELD, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 2)) place_container(ITEM_GEAR_IRONDAGGER, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 2)) place_container(ITEM_GEAR_IRONSWORD, 1, 1);
+      if (!(game_rand(RNG_SPAWN) % 2)) place_container(ITEM_GEAR_GREATSWORD, 1, 1);
       break;
     }
   }
 
   // give one mob a key
-  int ids[ENTITY_STACK_MAX], id_last = 0;
-  for (int i=0; i<ENTITY_STACK_MAX; i++) {
-    entity_t *e = entity_stack[i];
-    if (!e || !e->alive || e->ident != IDENT_NPC || !e->components.inventory)
-      continue;
-
-    ids[id_last++] = i;
+  entity_t *holders[ENTITY_STACK_MAX];
+  int holder_count = 0;
+  entity_query_t q;
+  entity_query(&q, COMP_BIT(COMP_AI) | COMP_BIT(COMP_INVENTORY));
+  for (entity_t *e; (e = entity_next(&q));) {
+    if (e->alive && e->ident == IDENT_NPC)
+      holders[holder_count++] = e;
   }
-  if (id_last) {
-    inventory_add(entity_stack[ids[rand() % id_last]], ITEM_KEY, 1);
+  if (holder_count) {
+    inventory_add(holders[game_rand(RNG_SPAWN) % holder_count], ITEM_KEY, 1);
   } else {
     place_container(ITEM_KEY, 1, 1);
     P_DBG("Error cannot generate key mob\n");
   }
+
+  // start on the next level, the stairs past depth 4 end the game
+  if (dungeon_depth < 4)
+    pregen_start(dungeon_depth + 1);
 }
 
 
 /*-----------------------------------------/
 /---------------- CORE STUFF --------------/
 /-----------------------------------------*/
+void game_seed(u32 seed)
+{
+  P_DBG("Seed %u\n", seed);
+
+  // a level made from the old streams would break the replay
+  render_thread_wait(pregen_thread);
+  pregen_thread = NULL;
+  pregen.ready = 0;
+
+  for (int i=0; i<RNG_NUM; i++)
+    rng_seed(&game_rng[i], seed, i);
+}
+
 ERR game_init()
 {
-  srand(time(NULL));
-  // srand(5);
-  
   // initialize the renderer
   if (render_init() == SUCCESS) {
     P_DBG("Renderer initialized\n");
@@ -401,7 +474,7 @@ ERR game_init()
   }
 
   // for delta time
-  last_frame_time = SDL_GetPerformanceCounter();
+  last_frame_time = render_time();
 
   // default keybinds
   keybinds[SDL_SCANCODE_A].action = &game_action_left;
@@ -438,6 +511,14 @@ ERR game_init()
   entity_tiles.ry = 0, entity_tiles.rh = entity_tiles.h;
   entity_tiles.tiles = calloc(1, sizeof(tile_t) * entity_tiles.w * entity_tiles.h);
 
+  // level tilemap, filled by generate_dungeon
+  level.x = 0, level.y = 0;
+  level.zoom = 1;
+  level.w = TILES_X, level.h = TILES_Y;
+  level.rx = 0, level.rw = level.w;
+  level.ry = 0, level.rh = level.h;
+  level.tiles = calloc(1, sizeof(tile_t) * level.w * level.h);
+
   ui_state = UI_STATE_MENU;
 
   generate_dungeon(dungeon_depth, 1);
@@ -453,8 +534,8 @@ int game_run()
   /---------------- UPDATE ------------------/
   /-----------------------------------------*/
   // calculate delta time
-  double current_frame_time = (double)SDL_GetPerformanceCounter();
-  delta_time = (double)(current_frame_time - last_frame_time) / (double)SDL_GetPerformanceFrequency();
+  double current_frame_time = render_time();
+  delta_time = current_frame_time - last_frame_time;
   last_frame_time = current_frame_time;
 
   // prevent spiral of death
@@ -475,74 +556,6 @@ int game_run()
     // do game update
     game_update(phys_delta_time, delta_time);
 
-    if (!player->alive) {
-      paused = 1;
-      if (ui_state == UI_STATE_END) {
-        ui_reset();
-        ui_end();
-      } else {
-        ui_reset();
-        ui_dead();
-      }
-    }
-
-    if (ui_state == UI_STATE_MENU) {
-      ui_menu();
-    }
-
-    // handle entities
-    float energy = player->energy;
-    int hp = player->stats.health;
-    for (int i=entity_index; i<ENTITY_STACK_MAX; i++) {
-      if (ui_rendering)
-        break;
-
-      if (projectile_run() || magic_mapping) {
-        break;
-      }
-
-      if (entity_index)
-        entity_index = 0;
-
-      // update entity
-      entity_t *e = entity_stack[i];
-      if (!e)
-        continue;
-
-      // are we already paused?
-      if (paused && !entity_index)
-        break;
-        
-      system_stats(e);
-      system_ai(e);
-      system_inventory(e);
-      system_move(e);
-      system_renderable(e);
-      system_energy(e);
-
-      // did this entity spawn a projectile?
-      if (projectile.tile) {
-        entity_index = i+1;
-        paused = 0;
-        break;
-      }
-
-      if (!e->alive && e->ident != IDENT_PLAYER)
-        entity_remove(e->id);
-
-      // an action might have not performed
-      // thus causing a re-pause
-      if (paused)
-        break;
-
-      if (e->ident == IDENT_PLAYER) {
-        player_path(player);
-      }
-    }
-
-    if (player->energy >= (ENERGY_MIN - 0.01f) && !player->move.dmap && player->inventory.fire == -1 && !projectile.tile)
-      paused = 1;
-
     // dec accumulator
     accumulator -= phys_delta_time;
   }
@@ -562,6 +575,8 @@ int game_run()
 
   // exit
   if (!running) {
+    render_thread_wait(pregen_thread);
+    pregen_thread = NULL;
     render_clean();
     vga_clean();
   }
@@ -707,6 +722,88 @@ void game_mousemotion(int dx, int dy)
 void game_update(double step, double dt)
 {
   tile_on = level.tiles[(player->position.to[1] * TILES_X) + player->position.to[0]].tile;
+
+  if (!player->alive) {
+    paused = 1;
+    if (ui_state == UI_STATE_END) {
+      ui_reset();
+      ui_end();
+    } else {
+      ui_reset();
+      ui_dead();
+    }
+  }
+
+  if (ui_state == UI_STATE_MENU) {
+    ui_menu();
+  }
+
+  // handle entities, only those with the energy to act are dispatched
+  int dispatched = 0;
+  while (!ui_rendering) {
+    if (projectile_run() || magic_mapping) {
+      break;
+    }
+
+    // are we already paused?
+    if (paused)
+      break;
+
+    int due;
+    entity_t *e = schedule_peek(&due);
+    if (!e)
+      break;
+
+    // one turn per step, turns where nobody can act are skipped
+    if (due > schedule_turn) {
+      if (dispatched)
+        break;
+      schedule_turn = due;
+    }
+
+    // update entity
+    schedule_pop();
+    schedule_sync(e, schedule_turn);
+    dispatched = 1;
+
+    system_stats(e);
+    system_ai(e);
+    system_inventory(e);
+    system_move(e);
+    system_renderable(e);
+    system_energy(e);
+
+    // did this entity spawn a projectile?
+    // the rest of the turn resumes once it lands
+    if (projectile.tile) {
+      paused = 0;
+      break;
+    }
+
+    if (!e->alive && e->ident != IDENT_PLAYER)
+      entity_remove(e->id);
+
+    // an action might have not performed
+    // thus causing a re-pause
+    if (paused)
+      break;
+
+    if (e->ident == IDENT_PLAYER) {
+      player_path(player);
+    }
+  }
+
+  // entities that did not act may have been killed, or sit where the
+  // fov relit, everyone else is drawn as they were
+  entity_reap();
+  system_renderable_dirty();
+
+  // input may act directly on the player while paused, so its energy
+  // has to be up to date for the turn it is waiting on
+  if (schedule_ready(player) && !player->move.dmap && player->inventory.fire == -1 && !projectile.tile) {
+    schedule_sync(player, schedule_turn + 1);
+    paused = 1;
+  }
 }
 
 void game_render()
@@ -719,28 +816,29 @@ void game_render()
     if (fov_alpha[i] <= 50.0f)
       continue;
 
-    if ((tile->tile == BLOCK_WATER || tile->tile == BLOCK_WATER_DEEP || tile->tile == BLOCK_FLOOR+1) && !(rand() % 200))
-      tile->a = fov_alpha[i] - (rand() % (fov_alpha[i]/4));
+    if ((tile->tile == BLOCK_WATER || tile->tile == BLOCK_WATER_DEEP || tile->tile == BLOCK_FLOOR+1) && !(game_rand(RNG_COSMETIC) % 200)) {
+      tile->a = fov_alpha[i] - (game_rand(RNG_COSMETIC) % (fov_alpha[i]/4));
+      tilesheet_dirty(&level, i);
+    }
   }
 
   if (ui_state == UI_STATE_AIM) {
     ui_reset();
     ui_state = UI_STATE_AIM;
-    int x = player->position.to[0], y = player->position.to[1];
-    int done = 0, distance = 0;
-    err = 999; err2=999;
-    while (!done) {
-      done = line(&x, &y, aim_x, aim_y);
-      if (!get_solid(level.tiles[(y*level.w)+x].tile) || distance > item_info[player->inventory.items[use_item]].range) {
-        aim_x = x;
-        aim_y = y;
+    line_t aim;
+    int distance = 0;
+    line_init(&aim, player->position.to[0], player->position.to[1], aim_x, aim_y);
+    while (line_step(&aim)) {
+      if (!get_solid(level.tiles[(aim.y*level.w)+aim.x].tile) || distance > item_info[player->inventory.items[use_item]].range) {
+        aim_x = aim.x;
+        aim_y = aim.y;
         break;
       }
 
       distance++;
-      ui_print("x", x, y, 255, 255, 0, 255);
+      ui_print("x", aim.x, aim.y, 255, 255, 0, 255);
     }
-    ui_print("x", x, y, 255, 0, 255, 255);
+    ui_print("x", aim.x, aim.y, 255, 0, 255, 255);
 
     ui_previous[0] = '\0';
     char buf[128];
@@ -778,6 +876,8 @@ void game_render()
       if (level_alpha[i])
         level_alpha[i] = 50;
     }
+    tilesheet_dirty_all(&level);
+    fov_reset();
 
     mapping_timer = 0.015f;
     magic_mapping--;
@@ -975,6 +1075,7 @@ void game_action_shoot()
   projectile.from[1] = player->position.to[1];
   projectile.to[0] = aim_x;
   projectile.to[1] = aim_y;
+  line_init(&projectile.line, projectile.from[0], projectile.from[1], projectile.to[0], projectile.to[1]);
   projectile.tile = 68+8;
   projectile.r = 255;
   projectile.g = 120;
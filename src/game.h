@@ -2,6 +2,8 @@
 #define GAME_H
 
 #include "main.h"
+#include "math/linmath.h"
+#include "util/rng.h"
 
 typedef enum {
   TILE_TYPE_SOLID,
@@ -17,11 +19,30 @@ typedef enum {
 
 typedef struct {
   int from[2], to[2];
+  line_t line;
   int tile, count;
   u8 r, g, b;
 } projectile_t;
 
+// independent random streams, drawing from one never shifts another
+typedef enum {
+  RNG_GEN,      // per level seeds for gen()
+  RNG_SPAWN,    // monster and container placement
+  RNG_COMBAT,   // monster turns and combat rolls
+  RNG_COSMETIC, // effects with no effect on play
+
+  RNG_NUM
+} rng_e;
+
+extern rng_t game_rng[RNG_NUM];
+
+static inline int game_rand(rng_e stream)
+{
+  return rng_rand(&game_rng[stream]);
+}
+
 extern projectile_t projectile;
+extern double projectile_timer;
 
 extern double game_tick;
 extern int path_to_player[], path_from_player[], path_to_mouse[];
@@ -34,6 +55,14 @@ extern int locked;
 
 void projectile_start(int fromx, int fromy, int tox, int toy, int t);
 
+void generate_dungeon(int depth, int reset);
+
+/**
+ * [game_seed restart every stream, call before game_init]
+ * @param seed [same seed, same run]
+ */
+void game_seed(u32 seed);
+
 ERR game_init();
 
 int game_run();
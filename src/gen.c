@@ -4,6 +4,10 @@
 static int max_width = 0;
 static int max_height = 0;
 
+rng_t *gen_rng = NULL;
+
+int cave_update = CAVE_DOUBLE_BUFFERED;
+
 /*
   How to solve the map generating long dead-ended paths:
   Define a maximum area for the map, try to place a room (only try a max of say, 100 times)
@@ -18,6 +22,84 @@ static int max_height = 0;
   then you punch a door out in that wall at the roll of a dice
 */
 
+/*---- ARENA ----*/
+#define GEN_BLOCK_SIZE (8 * 1024 * 1024)
+
+static gen_block_t *gen_arena = NULL, *gen_spare = NULL;
+
+// keep one released block around instead of freeing it
+static void gen_retire(gen_block_t *block)
+{
+  if (!gen_spare || gen_spare->size < block->size) {
+    free(gen_spare);
+    gen_spare = block;
+  } else {
+    free(block);
+  }
+}
+
+void *gen_alloc(size_t size)
+{
+  size = (size + 15) & ~(size_t)15;
+
+  // open a new block when the current one is full
+  if (!gen_arena || gen_arena->used + size > gen_arena->size) {
+    size_t block_size = MAX(GEN_BLOCK_SIZE, size);
+    gen_block_t *block = gen_spare;
+    if (block && block->size >= block_size)
+      gen_spare = NULL, block_size = block->size;
+    else
+      block = malloc(sizeof(gen_block_t) + block_size);
+    block->prev = gen_arena;
+    block->used = 0, block->last = 0;
+    block->size = block_size;
+    gen_arena = block;
+  }
+
+  gen_arena->last = gen_arena->used;
+  gen_arena->used += size;
+  return &gen_arena->data[gen_arena->last];
+}
+
+void gen_free(void *ptr)
+{
+  if (gen_arena && ptr == &gen_arena->data[gen_arena->last])
+    gen_arena->used = gen_arena->last;
+}
+
+gen_mark_t gen_mark()
+{
+  gen_mark_t mark = {gen_arena, 0, 0};
+  if (gen_arena)
+    mark.used = gen_arena->used, mark.last = gen_arena->last;
+  return mark;
+}
+
+void gen_release(gen_mark_t mark)
+{
+  while (gen_arena && gen_arena != mark.block) {
+    gen_block_t *prev = gen_arena->prev;
+    gen_retire(gen_arena);
+    gen_arena = prev;
+  }
+
+  if (gen_arena)
+    gen_arena->used = mark.used, gen_arena->last = mark.last;
+}
+
+void gen_reset()
+{
+  while (gen_arena && gen_arena->prev) {
+    gen_block_t *prev = gen_arena->prev;
+    gen_retire(gen_arena);
+    gen_arena = prev;
+  }
+
+  if (gen_arena)
+    gen_arena->used = gen_arena->last = 0;
+}
+/*---------------*/
+
 #define PREFAB_SIZE 32
 
 typedef struct {
@@ -43,6 +125,12 @@ prefab_t prefab_treasure = {
   ROOM_STORAGE
 };
 
+// tried in order, each room takes at most one
+prefab_t *prefabs[] = {
+  &prefab_treasure,
+};
+const int prefab_count = sizeof(prefabs) / sizeof(prefabs[0]);
+
 void print_slice(slice_t *map)
 {
   for (int y=0; y<map->height; y++) {
@@ -130,6 +218,30 @@ void place_box(slice_t *slice, u32 x, u32 y, u32 w, u32 h)
   }
 }
 
+// the original automaton, updates in place in scan order
+static void cave_in_place(slice_t *slice, u32 size)
+{
+  for (int i=0; i<16; i++) {
+    for (int y=0; y<size; y++) {
+      for (int x=0; x<size; x++) {
+        int alive = 0;
+        for (int j=y-1; j<=y+1; j++) {
+          for (int k=x-1; k<=x+1; k++) {
+            if (get_tile_block(slice, k, j) == BLOCK_FLOOR)
+              alive++;
+          }
+        }
+
+        if (alive < 5)
+          get_tile(slice, x, y)->block = BLOCK_NONE;
+        else
+          get_tile(slice, x, y)->block = BLOCK_FLOOR;
+
+      }
+    }
+  }
+}
+
 void place_cave(slice_t *slice, u32 size)
 {
   size = MAX(size, 12);
@@ -139,36 +251,84 @@ void place_cave(slice_t *slice, u32 size)
   float center_y = size/2 + 0.5f;
   int radius = size / 2;
 
+  // ray directions are the same every time
+  static double cave_cos[360*2], cave_sin[360*2];
+  static int cave_dirs = 0;
+  if (!cave_dirs) {
+    for (int i=0; i<360*2; i++) {
+      cave_cos[i] = cos((float)i/2.0f);
+      cave_sin[i] = sin((float)i/2.0f);
+    }
+    cave_dirs = 1;
+  }
+
   for (int i=0; i<360*2; i++) {
-    if (!(rand() % size/4))
+    if (!(rng_rand(gen_rng) % size/4))
       continue;
     for (int j=0; j<radius; j++) {
-      if (!(rand() % size/6))
+      if (!(rng_rand(gen_rng) % size/6))
         break;
-      float dx = center_x + cos((float)i/2.0f) * (float)j;
-      float dy = center_y + sin((float)i/2.0f) * (float)j;
+      float dx = center_x + cave_cos[i] * (float)j;
+      float dy = center_y + cave_sin[i] * (float)j;
       get_tile(slice, (int)dx, (int)dy)->block = BLOCK_FLOOR;
     }
   }
 
+  if (cave_update == CAVE_IN_PLACE) {
+    cave_in_place(slice, size);
+    return;
+  }
+
+  // pack the carved floor, bit x of row y
+  size = MIN(size, SLICE_SIZE);
+  u32 words = (size + 63) / 64;
+  static u64 cave_rows[2][SLICE_SIZE+2][2];
+  memset(cave_rows, 0, sizeof(cave_rows));
+  for (int y=0; y<size; y++)
+    for (int x=0; x<size; x++)
+      if (get_tile_block(slice, x, y) == BLOCK_FLOOR)
+        cave_rows[0][y+1][x >> 6] |= (u64)1 << (x & 63);
+
+  u64 mask[2] = {0, 0};
+  for (int x=0; x<size; x++)
+    mask[x >> 6] |= (u64)1 << (x & 63);
+
+  int cur = 0;
   for (int i=0; i<16; i++) {
-    for (int y=0; y<size; y++) {
-      for (int x=0; x<size; x++) {
-        int alive = 0;
-        for (int j=y-1; j<=y+1; j++) {
-          for (int k=x-1; k<=x+1; k++) {
-            if (get_tile_block(slice, k, j) == BLOCK_FLOOR)
-              alive++;
-          }
+    for (int y=1; y<=size; y++) {
+      for (int w=0; w<words; w++) {
+        // horizontal 3 sums of the rows above, at and below as 2 bit numbers
+        u64 s0[3], s1[3];
+        for (int r=0; r<3; r++) {
+          u64 *row = cave_rows[cur][y-1+r];
+          u64 c = row[w];
+          u64 l = (c << 1) | (w > 0 ? row[w-1] >> 63 : 0);
+          u64 rr = (c >> 1) | (w+1 < words ? row[w+1] << 63 : 0);
+          s0[r] = l ^ c ^ rr;
+          s1[r] = (l & c) | (rr & (l ^ c));
         }
 
-        if (alive < 5)
-          get_tile(slice, x, y)->block = BLOCK_NONE;
-        else
-          get_tile(slice, x, y)->block = BLOCK_FLOOR;
-
+        // add the three, the 4s column can hold two
+        u64 t0 = s0[0] ^ s0[1] ^ s0[2];
+        u64 k0 = (s0[0] & s0[1]) | (s0[2] & (s0[0] ^ s0[1]));
+        u64 u  = s1[0] ^ s1[1] ^ s1[2];
+        u64 m  = (s1[0] & s1[1]) | (s1[2] & (s1[0] ^ s1[1]));
+        u64 t1 = u ^ k0;
+        u64 k1 = u & k0;
+
+        // alive with 5 or more of the 9
+        u64 alive = (m & k1) | ((m ^ k1) & (t0 | t1));
+        cave_rows[!cur][y][w] = alive & mask[w];
       }
     }
+    cur = !cur;
+  }
+
+  for (int y=0; y<size; y++) {
+    for (int x=0; x<size; x++) {
+      int floor = (cave_rows[cur][y+1][x >> 6] >> (x & 63)) & 1;
+      get_tile(slice, x, y)->block = floor ? BLOCK_FLOOR : BLOCK_NONE;
+    }
   }
 }
 
@@ -189,7 +349,7 @@ void place_doors(slice_t *slice, u32 chance)
         }
       }
 
-      if (found_door || (rand() % chance))
+      if (found_door || (rng_rand(gen_rng) % chance))
         continue;
 
       u32 floor_a[] = {
@@ -286,7 +446,7 @@ void place_halls(slice_t *slice, u32 chance)
       int dy = CLAMP(empty_tile[1] - ground_tile[1], -1, 1);
 
       if (dx != 0 && dy != 0) {
-        if (!(rand() % 2))
+        if (!(rng_rand(gen_rng) % 2))
           dx = 0;
         else
           dy = 0;
@@ -340,7 +500,7 @@ void place_halls(slice_t *slice, u32 chance)
           if (get_tile(slice, x1, y1)->block == BLOCK_FLOOR || i == 9) {
             get_tile(slice, x1, y1)->block = BLOCK_FLOOR;
             get_tile(slice, x1-dx, y1-dy)->room_id = id;
-            if (!(rand() % chance)) {
+            if (!(rng_rand(gen_rng) % chance)) {
               get_tile(slice, x1-dx, y1-dy)->block = BLOCK_DOOR;
             }
             break;
@@ -358,6 +518,81 @@ void place_halls(slice_t *slice, u32 chance)
   }
 }
 
+/*---- ROOM STATS ----/
+  Per room id totals, built in one pass once the layout
+  is final and kept current by writing blocks through
+  room_set_block.
+*/
+typedef struct {
+  u32 size;                      // tiles carrying the id, walls included
+  int minx, miny, maxx, maxy;    // bounds of those tiles
+  u32 water;                     // water tiles, non-zero means it has a lake
+  u32 doors;                     // door and room floor pairs side by side
+  int prefab;                    // a prefab has been placed in it
+} room_stats_t;
+
+static inline int is_water(int block)
+{
+  return block == BLOCK_WATER || block == BLOCK_WATER_DEEP;
+}
+
+// apply d to the door count of every door/floor pair around x, y
+static void room_count_doors(slice_t *slice, room_stats_t *rooms, int x, int y, int d)
+{
+  tile_data_t *tile = get_tile(slice, x, y);
+  for (int k=0; k<4; k++) {
+    int tx = x + adjacent[k][0], ty = y + adjacent[k][1];
+    if (tx < 0 || ty < 0 || tx >= slice->width || ty >= slice->height)
+      continue;
+
+    tile_data_t *other = get_tile(slice, tx, ty);
+    if (tile->block == BLOCK_DOOR && other->block == BLOCK_FLOOR)
+      rooms[other->room_id].doors += d;
+    if (tile->block == BLOCK_FLOOR && other->block == BLOCK_DOOR)
+      rooms[tile->room_id].doors += d;
+  }
+}
+
+room_stats_t *room_stats_build(slice_t *slice)
+{
+  room_stats_t *rooms = gen_alloc(sizeof(room_stats_t) * slice->room_count);
+  for (int i=0; i<slice->room_count; i++) {
+    room_stats_t r = {0, slice->width, slice->height, -1, -1, 0, 0, 0};
+    rooms[i] = r;
+  }
+
+  for (int y=0; y<slice->height; y++) {
+    for (int x=0; x<slice->width; x++) {
+      tile_data_t *tile = get_tile(slice, x, y);
+      room_stats_t *room = &rooms[tile->room_id];
+      room->size++;
+      room->minx = MIN(room->minx, x), room->miny = MIN(room->miny, y);
+      room->maxx = MAX(room->maxx, x), room->maxy = MAX(room->maxy, y);
+      room->water += is_water(tile->block);
+
+      // count each pair from the door side only
+      if (tile->block == BLOCK_DOOR)
+        room_count_doors(slice, rooms, x, y, 1);
+    }
+  }
+
+  return rooms;
+}
+
+void room_set_block(slice_t *slice, room_stats_t *rooms, int x, int y, int block)
+{
+  tile_data_t *tile = get_tile(slice, x, y);
+  if (tile->block == block)
+    return;
+
+  room_count_doors(slice, rooms, x, y, -1);
+  rooms[tile->room_id].water -= is_water(tile->block);
+  tile->block = block;
+  rooms[tile->room_id].water += is_water(tile->block);
+  room_count_doors(slice, rooms, x, y, 1);
+}
+/*--------------------*/
+
 void clean_dungeon(slice_t *slice)
 {
   for (int y=1; y<slice->height-1; y++) {
@@ -389,24 +624,13 @@ void clean_dungeon(slice_t *slice)
   }
 }
 
-void place_lake(slice_t *slice)
+void place_lake(slice_t *slice, room_stats_t *rooms)
 {
+  // largest room without a lake so far
   int largest = 0, id = 0;
   for (int i=1; i<slice->room_count; i++) {
-    int size = 0;
-    for (int j=0; j<slice->width*slice->height; j++) {
-      if (slice->tiles[j].room_id == i) {
-        size++;
-        if (slice->tiles[j].block == BLOCK_WATER ||
-            slice->tiles[j].block == BLOCK_WATER_DEEP) {
-          size = 0;
-          break;
-        }
-      }
-    }
-
-    if (size > largest) {
-      largest = size;
+    if (!rooms[i].water && rooms[i].size > largest) {
+      largest = rooms[i].size;
       id = i;
     }
   }
@@ -414,8 +638,9 @@ void place_lake(slice_t *slice)
   if (!id)
     return;
 
-  for (int y=1; y<slice->height-1; y++) {
-    for (int x=1; x<slice->width-1; x++) {
+  room_stats_t *room = &rooms[id];
+  for (int y=MAX(room->miny, 1); y<=MIN(room->maxy, slice->height-2); y++) {
+    for (int x=MAX(room->minx, 1); x<=MIN(room->maxx, slice->width-2); x++) {
       tile_data_t *tile = get_tile(slice, x, y);
       if (tile->block != BLOCK_FLOOR || tile->room_id != id)
         continue;
@@ -436,12 +661,21 @@ void place_lake(slice_t *slice)
       if (walls)
         continue;
 
-      get_tile(slice, x, y)->block = BLOCK_WATER;
+      room_set_block(slice, rooms, x, y, BLOCK_WATER);
     }
   }
 
-  for (int y=1; y<slice->height-1; y++) {
-    for (int x=1; x<slice->width-1; x++) {
+  // water only exists inside rooms with lakes, scan just their bounds
+  int minx = slice->width, miny = slice->height, maxx = -1, maxy = -1;
+  for (int i=1; i<slice->room_count; i++) {
+    if (!rooms[i].water)
+      continue;
+    minx = MIN(minx, rooms[i].minx), miny = MIN(miny, rooms[i].miny);
+    maxx = MAX(maxx, rooms[i].maxx), maxy = MAX(maxy, rooms[i].maxy);
+  }
+
+  for (int y=MAX(miny, 1); y<=MIN(maxy, slice->height-2); y++) {
+    for (int x=MAX(minx, 1); x<=MIN(maxx, slice->width-2); x++) {
       tile_data_t *tile = get_tile(slice, x, y);
       if (tile->block != BLOCK_WATER)
         continue;
@@ -464,145 +698,135 @@ void place_lake(slice_t *slice)
           water++;
       }
 
-      if ((walls > 1 && !(rand() % 4)) || water <= 2)
-        tile->block = BLOCK_FLOOR;
+      if ((walls > 1 && !(rng_rand(gen_rng) % 4)) || water <= 2)
+        room_set_block(slice, rooms, x, y, BLOCK_FLOOR);
       if (water >= 8)
-        tile->block = BLOCK_WATER_DEEP;
+        room_set_block(slice, rooms, x, y, BLOCK_WATER_DEEP);
     }
   }
 }
 
-void place_prefab(slice_t *slice, prefab_t *prefab)
+/*---- PREFAB FIT ----/
+  Summed area tables over the final layout, a rect is
+  all floor of a single room when its floor count is the
+  area and the id and id squared sums are id*area and
+  id*id*area, so each fit test is four lookups per table.
+*/
+typedef struct {
+  u32 width;                     // slice width + 1
+  u32 *floors;
+  u64 *ids, *ids_sq;
+} prefab_fit_t;
+
+prefab_fit_t prefab_fit_build(slice_t *slice)
 {
-  u32 len = slice->width * slice->height;
-  int *positions_x = malloc(sizeof(int) * len);
-  int *positions_y = malloc(sizeof(int) * len);
-  int index = 0;
+  prefab_fit_t fit;
+  fit.width = slice->width + 1;
+  u32 len = fit.width * (slice->height + 1);
+  fit.floors = gen_alloc(sizeof(u32) * len);
+  fit.ids    = gen_alloc(sizeof(u64) * len);
+  fit.ids_sq = gen_alloc(sizeof(u64) * len);
+  memset(fit.floors, 0, sizeof(u32) * fit.width);
+  memset(fit.ids,    0, sizeof(u64) * fit.width);
+  memset(fit.ids_sq, 0, sizeof(u64) * fit.width);
+
   for (int y=0; y<slice->height; y++) {
+    u32 row = (y + 1) * fit.width, above = y * fit.width;
+    u32 floors = 0;
+    u64 ids = 0, ids_sq = 0;
+    fit.floors[row] = 0, fit.ids[row] = 0, fit.ids_sq[row] = 0;
     for (int x=0; x<slice->width; x++) {
-      positions_x[index] = x;
-      positions_y[index] = y;
-      index++;
+      tile_data_t *tile = get_tile(slice, x, y);
+      if (tile->block == BLOCK_FLOOR) {
+        u64 id = tile->room_id;
+        floors++, ids += id, ids_sq += id * id;
+      }
+      fit.floors[row + x + 1] = fit.floors[above + x + 1] + floors;
+      fit.ids[row + x + 1]    = fit.ids[above + x + 1] + ids;
+      fit.ids_sq[row + x + 1] = fit.ids_sq[above + x + 1] + ids_sq;
     }
   }
-  // randomize viable door list
-  for (int i=0; i<len; i++) {
-    int temp_x = positions_x[i];
-    int temp_y = positions_y[i];
 
-    size_t rand_index = rand() % len;
+  return fit;
+}
 
-    positions_x[i] = positions_x[rand_index];
-    positions_y[i] = positions_y[rand_index];
-    positions_x[rand_index] = temp_x;
-    positions_y[rand_index] = temp_y;
-  }
-  
+// is the w*h rect at x, y all floor of room id
+static inline int prefab_fits(prefab_fit_t *fit, int x, int y, int w, int h, u64 id)
+{
+  u32 a = y * fit->width + x, b = a + w;
+  u32 c = a + h * fit->width, d = c + w;
+  u64 area = (u64)w * h;
+  if (fit->floors[d] - fit->floors[b] - fit->floors[c] + fit->floors[a] != area)
+    return 0;
+  if (fit->ids[d] - fit->ids[b] - fit->ids[c] + fit->ids[a] != id * area)
+    return 0;
+  return fit->ids_sq[d] - fit->ids_sq[b] - fit->ids_sq[c] + fit->ids_sq[a] == id * id * area;
+}
+/*--------------------*/
+
+/**
+ * [place_prefab stamp prefab into a random fitting room]
+ * @param slice  [final layout]
+ * @param rooms  [room stats of slice]
+ * @param fit    [tables built from slice after lakes]
+ * @param prefab [prefab to place, kept a tile clear of the walls]
+ * @return       [room id used, 0 if nothing fits]
+ */
+int place_prefab(slice_t *slice, room_stats_t *rooms, prefab_fit_t *fit, prefab_t *prefab)
+{
+  int w = prefab->width + 2, h = prefab->height + 2;
   int room_id = 0, room_x = 0, room_y = 0;
-  for (int j=0; j<len; j++) {
-    int x = positions_x[j];
-    int y = positions_y[j];
+  u32 seen = 0;
 
-    tile_data_t *tile = get_tile(slice, x, y);
-    int id = tile->room_id;
-    if (tile->block != BLOCK_FLOOR)
+  for (int i=1; i<slice->room_count; i++) {
+    room_stats_t *room = &rooms[i];
+    if (room->prefab || room->doors > prefab->doors || room->size < w * h)
       continue;
 
-    // see if there's enough space
-    int nope = 0;
-    for (int y1=y; y1<=y+prefab->height; y1++) {
-      if (nope)
-        break;
-      for (int x1=x; x1<=x+prefab->width; x1++) {
-        if (nope)
-          break;
-        if (x1 < 0 || x1 > slice->width || y1 < 0 || y1 > slice->height) {
-          nope = 1;
-          break;
-        }
-
-        tile_data_t *tile2 = get_tile(slice, x1, y1);
-        if (tile2->room_id != id) {
-          nope = 1;
-          break;
-        }
-
-        if (tile2->block != BLOCK_FLOOR) {
-          nope = 1;
-          break;
-        }
-
-        if (x1 == x+(prefab->width-1) && y1 == y+(prefab->height-1)) {
-          int doors = 0;
-
-          for (int dy=0; dy<slice->height; dy++) {
-            for (int dx=0; dx<slice->width; dx++) {
-              if (get_tile(slice, dx, dy)->block == BLOCK_DOOR) {
-                for (int k=0; k<4; k++) {
-                  int tx = MAX(0, MIN(dx + adjacent[k][0], slice->width));
-                  int ty = MAX(0, MIN(dy + adjacent[k][1], slice->height));
-                  if (get_tile(slice, tx, ty)->room_id == tile->room_id && get_tile(slice, tx, ty)->block == BLOCK_FLOOR)
-                    doors++;
-                }
-              }
-            }
-          }
-
-          if (doors <= prefab->doors) {
-            room_id = tile->room_id;
-            room_x = x;
-            room_y = y;
-            nope = 1;
-            P_DBG("Doors %i\n", doors);
-            break;
-          }
-        }
+    // pick uniformly among every fitting spot
+    for (int y=room->miny; y<=room->maxy-h+1; y++) {
+      for (int x=room->minx; x<=room->maxx-w+1; x++) {
+        if (!prefab_fits(fit, x, y, w, h, i))
+          continue;
+        if (rng_rand(gen_rng) % ++seen == 0)
+          room_id = i, room_x = x + 1, room_y = y + 1;
       }
     }
-
-    if (room_id)
-      break; 
   }
-  free(positions_x);
-  free(positions_y);
 
   if (!room_id)
-    return;
+    return 0;
 
   for (int y=room_y; y<room_y+prefab->height; y++) {
     for (int x=room_x; x<room_x+prefab->width; x++) {
       int pindex = ((y-room_y) * prefab->width) + (x-room_x);
       int tile = prefab->tiles[pindex];
-      int entity = prefab->entities[pindex];
       if (tile)
-        get_tile(slice, x, y)->block = tile;
+        room_set_block(slice, rooms, x, y, tile);
     }
   }
 
-  // change blocks per room typeww
-  for (int i=0; i<slice->width*slice->height; i++) {
-    if (slice->tiles[i].room_id != room_id)
-      continue;
-
-    slice->tiles[i].room = prefab->room_type;
-
-    // switch (prefab->room_type) {
-    //   case ROOM_ARMORY: {
-    //     if (block == BLOCK_WALL)
-    //     break;
-    //   }
-    // }
+  // change room type
+  room_stats_t *room = &rooms[room_id];
+  room->prefab = 1;
+  for (int y=room->miny; y<=room->maxy; y++) {
+    for (int x=room->minx; x<=room->maxx; x++) {
+      tile_data_t *tile = get_tile(slice, x, y);
+      if (tile->room_id == room_id)
+        tile->room = prefab->room_type;
+    }
   }
 
   P_DBG("Found room %i\n", room_id);
+  return room_id;
 }
 
 void place_exit(slice_t *slice)
 {
   int done = 0;
   while (!done) {
-    int x = rand() % slice->width;
-    int y = rand() % slice->height;
+    int x = rng_rand(gen_rng) % slice->width;
+    int y = rng_rand(gen_rng) % slice->height;
     int tile = get_tile(slice, x, y)->block;
     if (tile == BLOCK_FLOOR) {
       get_tile(slice, x, y)->block = BLOCK_STAIRS;
@@ -611,8 +835,10 @@ void place_exit(slice_t *slice)
   }
 }
 
-void gen(tilesheet_packet_t *packet, int depth)
+void gen(tile_t *tiles, int depth, rng_t *rng)
 {
+  gen_rng = rng;
+
   // create initial empty map
   max_width = (WINDOW_WIDTH / TILE_RWIDTH) - 2;
   max_height = (WINDOW_HEIGHT / TILE_RHEIGHT) - 2;
@@ -624,19 +850,20 @@ void gen(tilesheet_packet_t *packet, int depth)
 
   // initial room (placed in center)
   slice_t slice = new_slice();
-  place_cave(&slice, 18 + rand() % (13 + cavern / 2));
+  place_cave(&slice, 18 + rng_rand(rng) % (13 + cavern / 2));
   clean_slice(&slice);
   compress_slice(&slice);
   slice_set_id(&slice, map.room_count++);
   place_slice(&map, &slice);
   destroy_slice(&slice);
 
-  for (int i=0; i<200 + rand() % 128; i++) {
+  for (int i=0; i<200 + rng_rand(rng) % 128; i++) {
+    gen_mark_t mark = gen_mark();
     slice_t room_parts = new_slice();
     slice = new_slice();
     for (int i=0; i<2; i++) {
-      if (!(rand() % 5)) {
-        place_circle(&slice, 0, 0, 3 + rand() % 2);
+      if (!(rng_rand(rng) % 5)) {
+        place_circle(&slice, 0, 0, 3 + rng_rand(rng) % 2);
         clean_slice(&slice);
         compress_slice(&slice);
         place_slice(&room_parts, &slice);
@@ -645,10 +872,10 @@ void gen(tilesheet_packet_t *packet, int depth)
       }
     }
     for (int i=0; i<3; i++) {
-      if (!(rand() % 2)) {
-        int size = 4 + rand() % 2;
-        place_box(&slice, 0, 0, size + (rand() % 2), size + (rand() % 2));
-        place_box(&slice, 0, 0, size + (rand() % 3), size + (rand() % 3));
+      if (!(rng_rand(rng) % 2)) {
+        int size = 4 + rng_rand(rng) % 2;
+        place_box(&slice, 0, 0, size + (rng_rand(rng) % 2), size + (rng_rand(rng) % 2));
+        place_box(&slice, 0, 0, size + (rng_rand(rng) % 3), size + (rng_rand(rng) % 3));
         clean_slice(&slice);
         compress_slice(&slice);
         place_slice(&room_parts, &slice);
@@ -657,10 +884,10 @@ void gen(tilesheet_packet_t *packet, int depth)
       }
     }
     for (int i=0; i<MIN(1, cavern-5); i++) {
-      if (!(rand() % 3)) {
+      if (!(rng_rand(rng) % 3)) {
         destroy_slice(&room_parts);
         room_parts = new_slice();
-        place_cave(&slice, 12 + (rand() % (5 + cavern)));
+        place_cave(&slice, 12 + (rng_rand(rng) % (5 + cavern)));
         clean_slice(&slice);
         compress_slice(&slice);
         place_slice(&room_parts, &slice);
@@ -673,16 +900,16 @@ void gen(tilesheet_packet_t *packet, int depth)
     clean_slice(&room_parts);
     compress_slice(&room_parts);
     place_slice(&map, &room_parts);
-    destroy_slice(&room_parts);
-    destroy_slice(&slice);
+    gen_release(mark);
   }
 
   for (int i=0; i<100; i++) {
+    gen_mark_t mark = gen_mark();
     slice_t room_parts = new_slice();
     slice = new_slice();
-    int size = 4 + rand() % 2;
-    place_box(&slice, 0, 0, size + (rand() % 2), size + (rand() % 2));
-    place_box(&slice, 0, 0, size + (rand() % 3), size + (rand() % 3));
+    int size = 4 + rng_rand(rng) % 2;
+    place_box(&slice, 0, 0, size + (rng_rand(rng) % 2), size + (rng_rand(rng) % 2));
+    place_box(&slice, 0, 0, size + (rng_rand(rng) % 3), size + (rng_rand(rng) % 3));
     clean_slice(&slice);
     compress_slice(&slice);
     place_slice(&room_parts, &slice);
@@ -691,7 +918,7 @@ void gen(tilesheet_packet_t *packet, int depth)
     clean_slice(&room_parts);
     compress_slice(&room_parts);
     place_slice(&map, &room_parts);
-    destroy_slice(&room_parts);
+    gen_release(mark);
   }
 
   if (depth < 5) {
@@ -701,15 +928,20 @@ void gen(tilesheet_packet_t *packet, int depth)
     place_halls(&map, 9999);
   }
   clean_dungeon(&map);
-  place_lake(&map);
-  place_lake(&map);
+
+  // layout is final, rooms only change through room_set_block from here
+  room_stats_t *rooms = room_stats_build(&map);
+  place_lake(&map, rooms);
+  place_lake(&map, rooms);
 
   for (int i=0; i<MAX(0, depth); i++) {
-    place_lake(&map);
+    place_lake(&map, rooms);
   }
 
   // do prefabs
-  // place_prefab(&map, &prefab_treasure);
+  prefab_fit_t fit = prefab_fit_build(&map);
+  for (int i=0; i<prefab_count; i++)
+    place_prefab(&map, rooms, &fit, prefabs[i]);
 
   // do exit and spawn
   place_exit(&map);
@@ -718,57 +950,50 @@ void gen(tilesheet_packet_t *packet, int depth)
   place_slice(&real_map, &map);
 
 
-  // generate tilemap packet
-  packet->x = 0, packet->y = 0;
-  packet->zoom = 1;
-  packet->w = (WINDOW_WIDTH / TILE_RWIDTH), packet->h = (WINDOW_HEIGHT / TILE_RHEIGHT);
-  packet->rx = 0, packet->rw = packet->w;
-  packet->ry = 0, packet->rh = packet->h;
-  if (packet->tiles)
-    free(packet->tiles);
-  packet->tiles = calloc(1, sizeof(tile_t) * packet->w * packet->h);
+  // generate tiles
+  memset(tiles, 0, sizeof(tile_t) * TILES_NUM);
   for (int y=0; y<real_map.height; y++) {
     for (int x=0; x<real_map.width; x++) {
-      u32 i = (y * packet->w) + x;
-      u32 i2 = (y * packet->w) + x;
-      packet->tiles[i].tile = real_map.tiles[i].block;
+      u32 i = (y * TILES_X) + x;
+      tiles[i].tile = real_map.tiles[i].block;
       int grass = MAX(2, 4 * (4 - depth));
-      if (packet->tiles[i].tile == BLOCK_FLOOR && !(rand() % grass))
-        packet->tiles[i].tile++;
-      switch (packet->tiles[i].tile) {
+      if (tiles[i].tile == BLOCK_FLOOR && !(rng_rand(rng) % grass))
+        tiles[i].tile++;
+      switch (tiles[i].tile) {
         case BLOCK_WALL: {
           if (get_tile(&real_map, x, y+1)->block == BLOCK_WALL)
-            packet->tiles[i].tile++;
+            tiles[i].tile++;
           break;
         }
       }
-      packet->tiles[i].r = 100 + (rand() % 80);
-      packet->tiles[i].g = 100 + (rand() % 80);
-      packet->tiles[i].b = 100 + (rand() % 80);
-      if (packet->tiles[i].tile == BLOCK_FLOOR) {
-        // packet->tiles[i].r += 50;
-        // packet->tiles[i].g += 50;
-        // packet->tiles[i].b += 50;
+      tiles[i].r = 100 + (rng_rand(rng) % 80);
+      tiles[i].g = 100 + (rng_rand(rng) % 80);
+      tiles[i].b = 100 + (rng_rand(rng) % 80);
+      if (tiles[i].tile == BLOCK_FLOOR) {
+        // tiles[i].r += 50;
+        // tiles[i].g += 50;
+        // tiles[i].b += 50;
       }
-      if (packet->tiles[i].tile == BLOCK_WATER) {
-        packet->tiles[i].r = 120;
-        packet->tiles[i].g = 120;
-        packet->tiles[i].b = 255;
+      if (tiles[i].tile == BLOCK_WATER) {
+        tiles[i].r = 120;
+        tiles[i].g = 120;
+        tiles[i].b = 255;
       }
-      if (packet->tiles[i].tile == BLOCK_WATER_DEEP) {
-        packet->tiles[i].r = 50;
-        packet->tiles[i].g = 50;
-        packet->tiles[i].b = 150;
+      if (tiles[i].tile == BLOCK_WATER_DEEP) {
+        tiles[i].r = 50;
+        tiles[i].g = 50;
+        tiles[i].b = 150;
       }
-      if (packet->tiles[i].tile == BLOCK_STAIRS) {
-        packet->tiles[i].r = 255;
-        packet->tiles[i].g = 120;
-        packet->tiles[i].b = 255;
+      if (tiles[i].tile == BLOCK_STAIRS) {
+        tiles[i].r = 255;
+        tiles[i].g = 120;
+        tiles[i].b = 255;
       }
-      packet->tiles[i].a = 255;
+      tiles[i].a = 255;
     }
   }
   // print_slice(&map);
 
-  free(map.tiles);
+  gen_reset();
+  gen_rng = NULL;
 }
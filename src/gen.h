@@ -9,6 +9,7 @@
 #include "db.h"
 #include "math/linmath.h"
 #include "render/render.h"
+#include "util/rng.h"
 
 /*
   Things the generator will need:
@@ -114,7 +115,72 @@ typedef struct {
   u32        room_id;  // unique room ID
 } tile_data_t;
 
-void gen(tilesheet_packet_t *packet, int depth);
+/**
+ * [gen generate a level, touches no game state so it can run off the main thread]
+ * @param tiles [caller owned TILES_NUM tiles to fill]
+ * @param depth [dungeon depth]
+ * @param rng   [sequence to draw from, only one gen() may run at a time]
+ */
+void gen(tile_t *tiles, int depth, rng_t *rng);
+
+// sequence of the running gen()
+extern rng_t *gen_rng;
+
+// how place_cave runs its automaton, in place reproduces the old scan
+// order dependent caves
+typedef enum {
+  CAVE_DOUBLE_BUFFERED,
+  CAVE_IN_PLACE,
+
+  CAVE_NUM
+} cave_e;
+
+extern int cave_update;
+
+/*---- ARENA ----/
+  Bump allocator backing slices and scratch lists for
+  the duration of one gen() call, reset when it returns.
+*/
+typedef struct gen_block_s {
+  struct gen_block_s *prev;
+  size_t used, last, size;
+  u8 data[];
+} gen_block_t;
+
+typedef struct {
+  gen_block_t *block;
+  size_t used, last;
+} gen_mark_t;
+
+/**
+ * [gen_alloc allocate uninitialized memory from the gen arena]
+ * @param  size [bytes]
+ * @return      [memory, valid until a release past it or gen_reset]
+ */
+void *gen_alloc(size_t size);
+
+/**
+ * [gen_free hand back memory early, only works for the newest allocation]
+ * @param ptr [memory from gen_alloc]
+ */
+void gen_free(void *ptr);
+
+/**
+ * [gen_mark remember the arena position]
+ * @return [mark for gen_release]
+ */
+gen_mark_t gen_mark();
+
+/**
+ * [gen_release drop everything allocated since a mark]
+ * @param mark [mark from gen_mark]
+ */
+void gen_release(gen_mark_t mark);
+
+/**
+ * [gen_reset drop everything, keeps one block around for the next level]
+ */
+void gen_reset();
 
 #define SLICE_SIZE 128
 
@@ -122,6 +188,15 @@ typedef struct {
   tile_data_t *tiles;
   u32 width, height;
   u32 room_count;
+
+  // door candidates of a placement target, built on first place_slice
+  // then kept up to date by blit_slice, NULL door_slot means unbuilt
+  u32 *doors, door_count;
+  int *door_slot;
+
+  // wall bitboard, bit x of row y, same lifetime rules as the doors
+  u64 *walls;
+  u32 wall_words;
 } slice_t;
 
 static inline slice_t new_slice() {
@@ -129,10 +204,11 @@ static inline slice_t new_slice() {
   slice.width  = SLICE_SIZE;
   slice.height = SLICE_SIZE;
   slice.room_count = 1;
-  slice.tiles  = malloc(sizeof(tile_data_t) * SLICE_SIZE * SLICE_SIZE);
-  memset(slice.tiles, 0, sizeof(tile_data_t) * SLICE_SIZE * SLICE_SIZE);
-  for (int i=0; i<SLICE_SIZE*SLICE_SIZE; i++)
-    slice.tiles[i].block = BLOCK_NONE;
+  slice.doors = NULL, slice.door_count = 0;
+  slice.door_slot = NULL;
+  slice.walls = NULL, slice.wall_words = 0;
+  slice.tiles  = gen_alloc(sizeof(tile_data_t) * SLICE_SIZE * SLICE_SIZE);
+  memset(slice.tiles, 0, sizeof(tile_data_t) * SLICE_SIZE * SLICE_SIZE); // BLOCK_NONE
   return slice;
 }
 
@@ -141,12 +217,16 @@ static inline slice_t new_slice_sized(u32 width, u32 height) {
   slice.width  = width;
   slice.height = height;
   slice.room_count = 1;
-  slice.tiles  = calloc(1, sizeof(tile_data_t) * width * height);
+  slice.doors = NULL, slice.door_count = 0;
+  slice.door_slot = NULL;
+  slice.walls = NULL, slice.wall_words = 0;
+  slice.tiles  = gen_alloc(sizeof(tile_data_t) * width * height);
+  memset(slice.tiles, 0, sizeof(tile_data_t) * width * height);
   return slice;
 }
 
 static inline void destroy_slice(slice_t *slice) {
-  free(slice->tiles);
+  gen_free(slice->tiles);
 }
 
 static inline block_e get_tile_block(slice_t *slice, u32 x, u32 y) {
@@ -165,7 +245,38 @@ static inline tile_data_t* get_tile(slice_t *slice, int x, int y) {
   return &slice->tiles[index];
 }
 
+// tiles were changed behind the indices, rebuild them on next use
+static inline void slice_index_reset(slice_t *slice) {
+  slice->door_slot = NULL;
+  slice->walls = NULL;
+}
+
+static inline void slice_walls_build(slice_t *slice) {
+  slice->wall_words = (slice->width + 63) / 64;
+  slice->walls = gen_alloc(sizeof(u64) * slice->wall_words * slice->height);
+  memset(slice->walls, 0, sizeof(u64) * slice->wall_words * slice->height);
+  for (int y=0; y<slice->height; y++)
+    for (int x=0; x<slice->width; x++)
+      if (slice->tiles[(y * slice->width) + x].block == BLOCK_WALL)
+        slice->walls[(y * slice->wall_words) + (x >> 6)] |= (u64)1 << (x & 63);
+}
+
+static inline void slice_set_wall(slice_t *slice, u32 index, int wall) {
+  if (!slice->walls)
+    return;
+
+  u32 x = index % slice->width, y = index / slice->width;
+  u64 *word = &slice->walls[(y * slice->wall_words) + (x >> 6)];
+  u64 bit = (u64)1 << (x & 63);
+  if (wall)
+    *word |= bit;
+  else
+    *word &= ~bit;
+}
+
 static inline void clean_slice(slice_t *slice) {
+  slice_index_reset(slice);
+
   // remove all walls
   for (int i=0; i<slice->width*slice->height; i++) {
     if (slice->tiles[i].block == BLOCK_WALL)
@@ -202,6 +313,71 @@ static inline void set_room(slice_t *slice, room_e room) {
 }
 // ---
 
+/*---- DOORS ----/
+  A door candidate is a wall with floor on one side
+  and nothing on the other, the direction is the first
+  match of floor left, right, up, down.
+*/
+static const int door_floor[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+
+static inline int slice_door_dir(slice_t *map, int x, int y) {
+  if (get_tile(map, x, y)->block != BLOCK_WALL)
+    return -1;
+
+  for (int i=0; i<4; i++) {
+    int fx = x + door_floor[i][0], fy = y + door_floor[i][1];
+    int ex = x - door_floor[i][0], ey = y - door_floor[i][1];
+    if (get_tile(map, fx, fy)->block == BLOCK_FLOOR &&
+        get_tile(map, ex, ey)->block == BLOCK_NONE)
+      return i;
+  }
+
+  return -1;
+}
+
+// re-test every tile in a rect, swap-removing stale candidates
+static inline void slice_doors_update(slice_t *map, int x0, int y0, int x1, int y1) {
+  if (!map->door_slot)
+    return;
+
+  x0 = MAX(x0, 0), y0 = MAX(y0, 0);
+  x1 = MIN(x1, (int)map->width-1), y1 = MIN(y1, (int)map->height-1);
+  for (int y=y0; y<=y1; y++) {
+    for (int x=x0; x<=x1; x++) {
+      u32 index = (y * map->width) + x;
+      int slot = map->door_slot[index];
+      int door = slice_door_dir(map, x, y) >= 0;
+
+      if (door && slot < 0) {
+        map->door_slot[index] = map->door_count;
+        map->doors[map->door_count++] = index;
+      } else if (!door && slot >= 0) {
+        u32 last = map->doors[--map->door_count];
+        map->doors[slot] = last;
+        map->door_slot[last] = slot;
+        map->door_slot[index] = -1;
+      }
+    }
+  }
+}
+
+static inline void slice_doors_build(slice_t *map) {
+  u32 len = map->width * map->height;
+  map->doors = gen_alloc(sizeof(u32) * len);
+  map->door_slot = gen_alloc(sizeof(int) * len);
+  map->door_count = 0;
+
+  // only walls can be candidates, skip the neighbour tests for the rest
+  for (u32 i=0; i<len; i++) {
+    map->door_slot[i] = -1;
+    if (map->tiles[i].block == BLOCK_WALL && slice_door_dir(map, i % map->width, i / map->width) >= 0) {
+      map->door_slot[i] = map->door_count;
+      map->doors[map->door_count++] = i;
+    }
+  }
+}
+/*---------------*/
+
 static inline void blit_slice(slice_t *map, slice_t *slice, u32 x, u32 y) {
   for (int iy=y; iy<y+slice->height; iy++) {
     for (int ix=x; ix<x+slice->width; ix++) {
@@ -210,23 +386,34 @@ static inline void blit_slice(slice_t *map, slice_t *slice, u32 x, u32 y) {
       if (t2->block == BLOCK_NONE)
         continue;
       *t1 = *t2;
+      slice_set_wall(map, t1 - map->tiles, t1->block == BLOCK_WALL);
     }
   }
+
+  // tiles bordering the blit can gain or lose candidacy too, blits
+  // hanging off the map land on clamped tiles so retest everything
+  int x0 = (int)x, y0 = (int)y;
+  if (x0 < 0 || y0 < 0 || x0 + slice->width > map->width || y0 + slice->height > map->height)
+    slice_doors_update(map, 0, 0, map->width-1, map->height-1);
+  else
+    slice_doors_update(map, x0-1, y0-1, x0 + slice->width, y0 + slice->height);
 }
 
+// the slice must fit on the map without any wall landing on a wall
 static inline int blit_possible(slice_t *map, slice_t *slice, u32 x, u32 y) {
-  for (int iy=y; iy<y+slice->height; iy++) {
-    for (int ix=x; ix<x+slice->width; ix++) {
-      if (x < 0 || x >= map->width || y < 0 || y >= map->height)
+  if (x >= map->width || y >= map->height)
+    return 0;
+  if (x + slice->width > map->width || y + slice->height > map->height)
+    return 0;
+
+  u32 base = x >> 6, shift = x & 63;
+  for (int iy=0; iy<slice->height; iy++) {
+    u64 *m = &map->walls[((y + iy) * map->wall_words) + base];
+    u64 *s = &slice->walls[iy * slice->wall_words];
+    for (int k=0; k<slice->wall_words; k++) {
+      if (m[k] & (s[k] << shift))
         return 0;
-
-      if (ix < 0 || ix >= map->width || iy < 0 || iy >= map->height)
-        return 0;
-
-      tile_data_t *t1 = get_tile(map, ix, iy);
-      tile_data_t *t2 = get_tile(slice, ix-x, iy-y);
-      if ((t1->block != BLOCK_NONE && t2->block != BLOCK_NONE) && 
-          (t1->block == BLOCK_WALL && t2->block == BLOCK_WALL))
+      if (shift && base + k + 1 < map->wall_words && (m[k+1] & (s[k] >> (64 - shift))))
         return 0;
     }
   }
@@ -240,86 +427,42 @@ static inline void slice_set_id(slice_t *slice, u32 id) {
 }
 
 static inline int place_slice(slice_t *map, slice_t *slice) {
-  typedef struct {
-    u32 x, y;
-    u32 ex, ey, fx, fy;
-  } door_t;
-
-  door_t *doors = malloc(sizeof(door_t) * map->width * map->height);
-  size_t door_i = 0;
-
-  // find all viable door tiles
-  for (int y=0; y<map->height; y++) {
-    for (int x=0; x<map->width; x++) {
-      if (get_tile(map, x, y)->block != BLOCK_WALL)
-        continue;
-
-      u32 floors[] = {
-        x-1, y,
-        x+1, y,
-        x,   y-1,
-        x,   y+1
-      };
-
-      u32 empty[] = {
-        x+1, y,
-        x-1, y,
-        x,   y+1,
-        x,   y-1
-      };
-
-      for (int i=0; i<4; i++) {
-        int fx = floors[(i*2)+0];
-        int fy = floors[(i*2)+1];
-        int ex = empty[(i*2)+0];
-        int ey = empty[(i*2)+1];
-        if (get_tile(map, fx, fy)->block == BLOCK_FLOOR &&
-            get_tile(map, ex, ey)->block == BLOCK_NONE) {
-          doors[door_i].x = x;
-          doors[door_i].y = y;
-          doors[door_i].ex = ex;
-          doors[door_i].ey = ey;
-          doors[door_i].fx = fx;
-          doors[door_i].fy = fy;
-          door_i++;
-          break;
-        }
-      }
-    }
-  }
+  if (!map->door_slot)
+    slice_doors_build(map);
+  if (!map->walls)
+    slice_walls_build(map);
+  slice_walls_build(slice);
 
   // no usable doors? place in center
-  if (!door_i) {
+  if (!map->door_count) {
     blit_slice(map, slice, (map->width/2)-(slice->width/2), (map->height/2)-(slice->height/2));
-    goto done;
+    return 1;
   }
 
-  // randomize viable door list
-  for (int i=0; i<door_i; i++) {
-    door_t temp_door = doors[i];
-    size_t rand_index = rand() % door_i;
-    doors[i] = doors[rand_index];
-    doors[rand_index] = temp_door;
-  }
+  // try candidates in random order, shuffling only as far as we get
+  for (u32 i=0; i<map->door_count; i++) {
+    u32 j = i + (rng_rand(gen_rng) % (map->door_count - i));
+    u32 door = map->doors[j];
+    map->doors[j] = map->doors[i], map->door_slot[map->doors[j]] = j;
+    map->doors[i] = door, map->door_slot[door] = i;
 
-  u32 width  = slice->width;
-  u32 height = slice->height;
+    u32 door_x = door % map->width;
+    u32 door_y = door / map->width;
+    int dir = slice_door_dir(map, door_x, door_y);
+    u32 ex = door_x - door_floor[dir][0];
+    u32 ey = door_y - door_floor[dir][1];
 
-  // find usable door position
-  for (int i=0; i<door_i; i++) {
-    u32 from_x = doors[i].x - (slice->width);
-    u32 from_y = doors[i].y - (slice->height);
-    u32 to_x   = doors[i].x + slice->width;
-    u32 to_y   = doors[i].y + slice->height;
+    u32 from_x = door_x - (slice->width);
+    u32 from_y = door_y - (slice->height);
+    u32 to_x   = door_x + slice->width;
+    u32 to_y   = door_y + slice->height;
 
     for (int y=from_y; y<to_y; y++) {
       for (int x=from_x; x<to_x; x++) {
-        u32 door_x = doors[i].x;
-        u32 door_y = doors[i].y;
-        u32 dx = door_x + (doors[i].ex - doors[i].x);
-        u32 dy = door_y + (doors[i].ey - doors[i].y);
-        u32 rx = door_x + ((doors[i].ex - doors[i].x) * 2);
-        u32 ry = door_y + ((doors[i].ey - doors[i].y) * 2);
+        u32 dx = door_x + (ex - door_x);
+        u32 dy = door_y + (ey - door_y);
+        u32 rx = door_x + ((ex - door_x) * 2);
+        u32 ry = door_y + ((ey - door_y) * 2);
 
         if (get_tile_block(slice, dx-x, dy-y) == BLOCK_WALL &&
             get_tile_block(slice, rx-x, ry-y) == BLOCK_FLOOR &&
@@ -329,18 +472,16 @@ static inline int place_slice(slice_t *map, slice_t *slice) {
           blit_slice(map, slice, x, y);
           get_tile(map, door_x, door_y)->block = BLOCK_FLOOR;
           get_tile(map, dx, dy)->block = BLOCK_FLOOR;
-          goto done;
+          slice_set_wall(map, get_tile(map, door_x, door_y) - map->tiles, 0);
+          slice_set_wall(map, get_tile(map, dx, dy) - map->tiles, 0);
+          slice_doors_update(map, MIN(door_x, dx)-1, MIN(door_y, dy)-1, MAX(door_x, dx)+1, MAX(door_y, dy)+1);
+          return 1;
         }
       }
     }
   }
 
-  free(doors);
   return 0;
-
-  done:
-  free(doors);
-  return 1;
 }
 
 static inline void compress_slice(slice_t *map)
@@ -368,7 +509,7 @@ static inline void compress_slice(slice_t *map)
 
   maxx++; maxy++;
   u32 width = maxx - minx, height = maxy - miny;
-  tile_data_t *new_tiles = malloc(sizeof(tile_data_t) * width * height);
+  tile_data_t *new_tiles = gen_alloc(sizeof(tile_data_t) * width * height);
 
   // extract the section from the tile data
   for (int y=miny; y<maxy; y++) {
@@ -379,8 +520,9 @@ static inline void compress_slice(slice_t *map)
     }
   }
 
-  // replace old tile data with newly extracted section
-  free(map->tiles);
+  // replace old tile data with newly extracted section, the old
+  // tiles stay in the arena until the caller releases them
+  slice_index_reset(map);
   map->tiles  = new_tiles;
   map->width  = width;
   map->height = height;
@@ -0,0 +1,145 @@
+/* bench
+  Headless benchmark, generates dungeons and lets a
+  simple bot play them through the null renderer.
+  Reports turns/sec, gen ms/level and dmap/fov us/call.
+
+  usage: game_bench [levels] [turns per level]
+*/
+
+#include <time.h>
+#include "game.h"
+#include "gen.h"
+#include "entity.h"
+#include "ui.h"
+
+#define BENCH_SAMPLES 64
+#define BENCH_HEALTH  (1 << 20) // no frame deals this much, the bot never dies
+
+extern tilesheet_packet_t level;
+extern entity_t *player;
+
+static double seconds(clock_t t)
+{
+  return (double)t / (double)CLOCKS_PER_SEC;
+}
+
+static void bench_floor(int *x, int *y)
+{
+  int tile = 0;
+  while (tile != BLOCK_FLOOR) {
+    *x = rand() % level.w;
+    *y = rand() % level.h;
+    tile = level.tiles[(*y * level.w) + *x].tile;
+  }
+}
+
+// attack anything adjacent, otherwise walk towards a random floor tile
+static void bench_bot()
+{
+  for (int j=0; j<8; j++) {
+    int tx = player->position.to[0] + around[j][0];
+    int ty = player->position.to[1] + around[j][1];
+    entity_t *e = entity_get_npc(tx, ty);
+    if (e && e != player) {
+      action_move(player, tx, ty);
+      paused = 0;
+      return;
+    }
+  }
+
+  int x, y;
+  bench_floor(&x, &y);
+  dijkstra(path_to_mouse, x, y, TILES_X, TILES_Y);
+  action_path(player, path_to_mouse, TILES_X, TILES_Y);
+  paused = 0;
+}
+
+int main(int argc, char **argv)
+{
+  int levels = argc > 1 ? atoi(argv[1]) : 20;
+  int turns  = argc > 2 ? atoi(argv[2]) : 1000;
+
+  game_seed(1);
+  if (game_init() != SUCCESS) {
+    printf("Unable to initialize game\n");
+    return FAILURE;
+  }
+
+  // the bot still draws from rand()
+  srand(1);
+
+  clock_t gen_time = 0, dmap_time = 0, ray_time = 0, shadow_time = 0, turn_time = 0;
+  int samples = 0, turns_run = 0, deaths = 0, reset = 1;
+  for (int l=0; l<levels; l++) {
+    dungeon_depth = l % 5;
+
+    clock_t t = clock();
+    generate_dungeon(dungeon_depth, reset);
+    gen_time += clock() - t;
+    ui_state = UI_STATE_NONE;
+    paused = 0;
+    reset = 0;
+
+    // dmap and fov from random floor tiles
+    int xs[BENCH_SAMPLES], ys[BENCH_SAMPLES];
+    for (int i=0; i<BENCH_SAMPLES; i++)
+      bench_floor(&xs[i], &ys[i]);
+
+    t = clock();
+    for (int i=0; i<BENCH_SAMPLES; i++)
+      dijkstra(path_to_mouse, xs[i], ys[i], TILES_X, TILES_Y);
+    dmap_time += clock() - t;
+
+    entity_t probe = {0};
+    t = clock();
+    for (int i=0; i<BENCH_SAMPLES; i++) {
+      probe.position.to[0] = xs[i]; probe.position.to[1] = ys[i];
+      fov_raycast(&probe);
+    }
+    ray_time += clock() - t;
+
+    t = clock();
+    for (int i=0; i<BENCH_SAMPLES; i++) {
+      probe.position.to[0] = xs[i]; probe.position.to[1] = ys[i];
+      fov_shadowcast(&probe);
+    }
+    shadow_time += clock() - t;
+    samples += BENCH_SAMPLES;
+
+    // forget what the probes lit
+    memset(level_alpha, 0, TILES_NUM);
+    memset(fov_alpha, 0, TILES_NUM);
+    fov_reset();
+    fov(player);
+
+    // bot driven turns
+    int start = schedule_turn;
+    t = clock();
+    for (int frame=0; schedule_turn - start < turns && frame < turns * 100; frame++) {
+      // god mode, so every level runs the whole turn budget
+      player->stats.health = player->stats.max_health = BENCH_HEALTH;
+      game_run();
+
+      if (!player->alive) {
+        deaths++;
+        reset = 1;
+        break;
+      }
+
+      if (paused)
+        bench_bot();
+    }
+    turn_time += clock() - t;
+    turns_run += schedule_turn - start;
+  }
+
+  printf("levels         %i\n", levels);
+  printf("turns          %i (%i deaths)\n", turns_run, deaths);
+  printf("turns/sec      %.1f\n", turns_run / seconds(turn_time));
+  printf("gen ms/level   %.3f\n", 1000.0 * seconds(gen_time) / levels);
+  printf("dmap us/call   %.2f\n", 1000000.0 * seconds(dmap_time) / samples);
+  printf("fov us/call    %.2f raycast, %.2f shadowcast\n",
+    1000000.0 * seconds(ray_time) / samples, 1000000.0 * seconds(shadow_time) / samples);
+
+  return SUCCESS;
+}
@@ -0,0 +1,70 @@
+/* io_bench
+  Save latency of a config, one open per line through
+  io_write against the buffered writer used by ini_save.
+
+  usage: io_bench [keys] [saves]
+*/
+
+#include <time.h>
+#include "util/ini.h"
+#include "util/io.h"
+
+static double seconds(clock_t t)
+{
+  return (double)t / (double)CLOCKS_PER_SEC;
+}
+
+// what ini_save used to do, empty the file then append per line
+static void save_per_line(ini_t *ini, const char *path)
+{
+  char buf[1024];
+  io_write(path, "", 0, 0);
+  io_write(path, "[bench]\n", 8, 1);
+  for (int i=0; i<ini->count; i++) {
+    ini_var_t *var = &ini->pages[i / INI_PAGE_SIZE][i % INI_PAGE_SIZE];
+    const char *name = &ini->strings[var->name];
+    sprintf(buf, "%s = %.2f\n", &name[strlen(name)+1], var->f);
+    io_write(path, buf, strlen(buf), 1);
+  }
+  io_write(path, "\n", 1, 1);
+}
+
+int main(int argc, char **argv)
+{
+  int keys  = argc > 1 ? atoi(argv[1]) : 64;
+  int saves = argc > 2 ? atoi(argv[2]) : 200;
+
+  // save into the working dir
+  PHYSFS_init(argv[0]);
+  if (!PHYSFS_setWriteDir(".")) {
+    printf("Unable to set write dir: %s\n", PHYSFS_ERR);
+    return FAILURE;
+  }
+
+  ini_t ini = {0};
+  char key[64];
+  for (int i=0; i<keys; i++) {
+    sprintf(key, "key_%i", i);
+    ini_set_float(&ini, "bench", key, (float)i);
+  }
+
+  clock_t t = clock();
+  for (int i=0; i<saves; i++)
+    save_per_line(&ini, "io_bench.ini");
+  clock_t line_time = clock() - t;
+
+  t = clock();
+  for (int i=0; i<saves; i++)
+    ini_save(&ini, "io_bench.ini");
+  clock_t buffered_time = clock() - t;
+
+  PHYSFS_delete("io_bench.ini");
+  ini_free(&ini);
+  PHYSFS_deinit();
+
+  printf("keys           %i\n", keys);
+  printf("per line ms    %.3f\n", 1000.0 * seconds(line_time) / saves);
+  printf("buffered ms    %.3f\n", 1000.0 * seconds(buffered_time) / saves);
+
+  return SUCCESS;
+}
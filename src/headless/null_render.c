@@ -0,0 +1,107 @@
+/* null render
+  Stands in for render.c, vga.c and input.c when
+  the simulation runs without a window or GL context.
+  Frame logic still runs, nothing is drawn.
+*/
+
+#include "game.h"
+#include "ui.h"
+#include "render/render.h"
+#include "render/vga.h"
+#include "input/input.h"
+
+int mouse_x = 0, mouse_y = 0;
+u8 keys_down[SDL_NUM_SCANCODES];
+u8 buttons_down[16];
+
+// virtual clock, every frame is exactly one fixed step
+static double null_time = 0.0;
+
+ERR render_init()
+{
+  ui_init();
+
+  return SUCCESS;
+}
+
+void render_render()
+{
+  game_render();
+  ui_render();
+}
+
+int render_update()
+{
+  return 1;
+}
+
+void render_clean()
+{
+
+}
+
+void render_tilemap(tilesheet_packet_t *packet)
+{
+
+}
+
+void render_translate_mouse(int *mx, int *my)
+{
+
+}
+
+double render_time()
+{
+  null_time += 1.0 / 60.0;
+  return null_time;
+}
+
+// no threads headless, keeps runs deterministic
+void *render_thread(int (*fn)(void*), const char *name, void *data)
+{
+  fn(data);
+  return NULL;
+}
+
+void render_thread_wait(void *thread)
+{
+
+}
+
+/*-----------------------------------------/
+/---------------- VGA ---------------------/
+/-----------------------------------------*/
+void vga_init()
+{
+
+}
+
+void vga_print(size_t x, size_t y, const char *str)
+{
+
+}
+
+void vga_render()
+{
+
+}
+
+void vga_clear()
+{
+
+}
+
+void vga_setfg(u8 r, u8 g, u8 b, u8 a)
+{
+
+}
+
+void vga_setbg(u8 r, u8 g, u8 b, u8 a)
+{
+
+}
+
+void vga_clean()
+{
+
+}
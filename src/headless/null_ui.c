@@ -0,0 +1,41 @@
+/* null ui
+  Discards everything the game asks the ui to
+  show, only ui_tiles is kept as game.c writes
+  projectiles into it directly.
+*/
+
+#include "game.h"
+#include "ui.h"
+
+int ui_rendering = 0;
+int ui_state = 0;
+int ui_count = 0;
+char ui_previous[128];
+tilesheet_packet_t ui_tiles = {NULL};
+
+void ui_init()
+{
+  ui_tiles.x = 0, ui_tiles.y = 0;
+  ui_tiles.zoom = 1;
+  ui_tiles.w = (WINDOW_WIDTH / TILE_RWIDTH), ui_tiles.h = (WINDOW_HEIGHT / TILE_RHEIGHT);
+  ui_tiles.rx = 0, ui_tiles.rw = ui_tiles.w;
+  ui_tiles.ry = 0, ui_tiles.rh = ui_tiles.h;
+  ui_tiles.tiles = calloc(1, sizeof(tile_t) * ui_tiles.w * ui_tiles.h);
+}
+
+void ui_render() {}
+void ui_print_entity(entity_t *e, const char *str, u32 y, u8 r, u8 g, u8 b, u8 a) {}
+void ui_print_entity_up(entity_t *e, const char *str, u32 y, u8 r, u8 g, u8 b, u8 a) {}
+void ui_print_entity_down(entity_t *e, const char *str, u32 y, u8 r, u8 g, u8 b, u8 a) {}
+void ui_popup(entity_t *e, const char *str, u8 r, u8 g, u8 b, u8 a) {}
+int ui_print(const char *str, u32 x, u32 y, u8 r, u8 g, u8 b, u8 a) { return 0; }
+void ui_reset() {}
+void ui_inventory(entity_t *e) {}
+void ui_fire(entity_t *e) {}
+void ui_use(entity_t *e) {}
+void ui_item(entity_t *e, int item) {}
+void ui_character() {}
+void ui_dead() {}
+void ui_end() {}
+void ui_inspect(entity_t *e) {}
+void ui_menu() {}
@@ -1,5 +1,6 @@
 #define SDL_MAIN_HANDLED 1
 
+#include <time.h>
 #include "main.h"
 #include "game.h"
 
@@ -38,8 +39,7 @@ int main(int argc, char **argv)
     P_ERR("PhysFS cannot mount dir %s: %s\n", DATA_ZIP_PATH, PHYSFS_ERR);
 
   // load the config file
-  conf = malloc(sizeof(ini_t));
-  conf->length = 0;
+  conf = calloc(1, sizeof(ini_t));
   if (ini_load(conf, "data/conf.ini") == SUCCESS)
     P_DBG("Loaded base config file\n");
   else
@@ -49,6 +49,11 @@ int main(int argc, char **argv)
 
   /*-----------------------------------------/
   /---------------- LOOP -------------------*/
+  // same seed replays the same run, 0 picks one from the clock
+  // ini numbers are floats, past 24 bits a logged seed would not read back
+  u32 seed = (u32)ini_get_float(conf, "game", "seed");
+  game_seed(seed ? seed : ((u32)time(NULL) & 0xffffff));
+
   if (game_init() == SUCCESS) {
     P_DBG("Game initialized\n");
   } else {
@@ -64,6 +69,7 @@ int main(int argc, char **argv)
 
   /*-----------------------------------------/
   /---------------- EXIT -------------------*/
+  ini_free(conf);
   free(conf);
 
   P_DBG("Clean exit\n");
@@ -48,47 +48,106 @@ static int around_adjacent[8][2] = {
   {1,  1},
   {-1, 1}
 };
+// bresenham line state, one per traced line
 typedef struct {
-  
-} line_packet_t;
-
-static int err = 999, err2 = 999;
-static int line(int *x, int *y, int x1, int y1) {
-  int x0 = *x;
-  int y0 = *y;
-
-  int dx = abs(x1-x0);
-  int dy = abs(y1-y0);
-
-  int sx = x0 < x1 ? 1 : -1;
-  int sy = y0 < y1 ? 1 : -1;
-
-  if (err == 999 || err2 == 999)
-    err2, err = (dx > dy ? dx : -dy) / 2;
-
-  int done = 0;
-
-  for (;;) {
-    if (x0 == x1 && y0 == y1) {
-      done = 1;
-      err = 999;
-      break;
-    }
-    err2 = err;
-    if (err2 > -dx) {
-      err -= dy;
-      x0 += sx;
-    }
-    if (err2 < dy) {
-      err += dx;
-      y0 += sy;
-    }
-    break;
+  int x, y;
+  int x1, y1;
+  int dx, dy;
+  int sx, sy;
+  int err;
+} line_t;
+
+static inline void line_init(line_t *l, int x0, int y0, int x1, int y1)
+{
+  l->x  = x0;
+  l->y  = y0;
+  l->x1 = x1;
+  l->y1 = y1;
+  l->dx = abs(x1-x0);
+  l->dy = abs(y1-y0);
+  l->sx = x0 < x1 ? 1 : -1;
+  l->sy = y0 < y1 ? 1 : -1;
+  l->err = (l->dx > l->dy ? l->dx : -l->dy) / 2;
+}
+
+// step once towards the end point, 0 once it has been reached
+static inline int line_step(line_t *l)
+{
+  if (l->x == l->x1 && l->y == l->y1)
+    return 0;
+
+  int e2 = l->err;
+  if (e2 > -l->dx) {
+    l->err -= l->dy;
+    l->x += l->sx;
+  }
+  if (e2 < l->dy) {
+    l->err += l->dx;
+    l->y += l->sy;
+  }
+
+  return 1;
+}
+
+#define LINE_BATCH_MAX 1024
+
+// a fan of lines from one origin, stepped in lock-step
+typedef struct {
+  int n;
+  int x[LINE_BATCH_MAX], y[LINE_BATCH_MAX];
+  int x1[LINE_BATCH_MAX], y1[LINE_BATCH_MAX];
+  int dx[LINE_BATCH_MAX], dy[LINE_BATCH_MAX];
+  int sx[LINE_BATCH_MAX], sy[LINE_BATCH_MAX];
+  int err[LINE_BATCH_MAX];
+  int live[LINE_BATCH_MAX];
+} line_batch_t;
+
+static inline void line_batch_init(line_batch_t *b)
+{
+  b->n = 0;
+}
+
+// returns the line index, or -1 when the batch is full
+static inline int line_batch_add(line_batch_t *b, int x0, int y0, int x1, int y1)
+{
+  if (b->n >= LINE_BATCH_MAX)
+    return -1;
+
+  int i = b->n++;
+  b->x[i]  = x0;
+  b->y[i]  = y0;
+  b->x1[i] = x1;
+  b->y1[i] = y1;
+  b->dx[i] = abs(x1-x0);
+  b->dy[i] = abs(y1-y0);
+  b->sx[i] = x0 < x1 ? 1 : -1;
+  b->sy[i] = y0 < y1 ? 1 : -1;
+  b->err[i] = (b->dx[i] > b->dy[i] ? b->dx[i] : -b->dy[i]) / 2;
+  b->live[i] = 1;
+  return i;
+}
+
+// step every live line once, clear live[i] to stop a line early
+// returns the number of lines that moved
+static inline int line_batch_step(line_batch_t *b)
+{
+  int moved = 0;
+
+  // branch free so the loop vectorises
+  for (int i=0; i<b->n; i++) {
+    int go = b->live[i] & !((b->x[i] == b->x1[i]) & (b->y[i] == b->y1[i]));
+    int e2 = b->err[i];
+    int mx = go & (e2 > -b->dx[i]);
+    int my = go & (e2 < b->dy[i]);
+
+    b->err[i] += (my * b->dx[i]) - (mx * b->dy[i]);
+    b->x[i] += mx * b->sx[i];
+    b->y[i] += my * b->sy[i];
+    b->live[i] = go;
+    moved += go;
   }
 
-  *x = x0;
-  *y = y0;
-  return done;
+  return moved;
 }
 
 static inline double median(double a, double b, double c)
@@ -18,24 +18,37 @@ typedef struct {
   u32 width, height, count;
 } canvas_t;
 
+float *conf_window_width, *conf_window_height;
+
 static SDL_Window *window = NULL;
 static SDL_GLContext context = NULL;
 
 // canvases
-static canvas_t screen_canvas, hblur_canvas, vblur_canvas;
+static canvas_t screen_canvas;
+
+// bloom mip chain, level 0 is the widest and ends up holding the glow
+#define BLOOM_PASSES_MAX 8
+static canvas_t bloom_canvas[BLOOM_PASSES_MAX];
+static int bloom_passes;
+
+// {passes, resolution divisor} per bloom_quality 1..3, 2 is close to
+// the old 20 pass full resolution gaussian
+static const int bloom_presets[][2] = {
+  {2, 4},
+  {3, 2},
+  {5, 1}
+};
 
 extern tilesheet_packet_t ui_tiles;
 
 typedef struct {
-  GLuint vao, vbo, shader;
   u32 tile_count;
-  float    *vertices;
-  u32 vertex_count;
-  u32 width,  height;
-  u32 rwidth, rheight;
   mat4x4   transform;
   texture_t *texture;
   float *tile_uv;
+  GLuint uv_buffer, uv_texture;
+  tile_t *cells;
+  size_t cell_count;
   int initialized;
 } render_tilemap_t;
 
@@ -114,8 +127,10 @@ ERR render_init()
   SDL_GL_SetAttribute(SDL_GL_FRAMEBUFFER_SRGB_CAPABLE, 0);
 
   // get conf vars
-  size_t width  = (size_t)ini_get_float(conf, "graphics", "window_width");
-  size_t height = (size_t)ini_get_float(conf, "graphics", "window_height");
+  conf_window_width  = ini_get_float_handle(conf, "graphics", "window_width");
+  conf_window_height = ini_get_float_handle(conf, "graphics", "window_height");
+  size_t width  = (size_t)*conf_window_width;
+  size_t height = (size_t)*conf_window_height;
 
   // set conf vars if unset
   if (!width) {
@@ -187,8 +202,29 @@ ERR render_init()
 
   // screen framebuffer
   screen_canvas = render_new_canvas(WINDOW_WIDTH, WINDOW_HEIGHT, GL_RGBA, GL_RGBA, GL_FLOAT, GL_FALSE, 1);
-  hblur_canvas  = render_new_canvas(WINDOW_WIDTH, WINDOW_HEIGHT, GL_RGBA, GL_RGBA, GL_FLOAT, GL_FALSE, 1);
-  vblur_canvas  = render_new_canvas(WINDOW_WIDTH, WINDOW_HEIGHT, GL_RGBA, GL_RGBA, GL_FLOAT, GL_FALSE, 1);
+
+  // bloom canvases, passes and resolution fall back to the quality preset
+  int quality = (int)ini_get_float(conf, "graphics", "bloom_quality");
+  if (!quality) {
+    quality = 2;
+    ini_set_float(conf, "graphics", "bloom_quality", (float)quality);
+  }
+  quality = CLAMP(quality, 1, 3);
+
+  bloom_passes = (int)ini_get_float(conf, "graphics", "bloom_passes");
+  int bloom_scale = (int)ini_get_float(conf, "graphics", "bloom_scale");
+  if (!bloom_passes)
+    bloom_passes = bloom_presets[quality-1][0];
+  if (!bloom_scale)
+    bloom_scale = bloom_presets[quality-1][1];
+  bloom_passes = CLAMP(bloom_passes, 1, BLOOM_PASSES_MAX);
+  bloom_scale  = CLAMP(bloom_scale, 1, 16);
+
+  for (int i=0; i<bloom_passes; i++) {
+    u32 w = MAX(WINDOW_WIDTH / (bloom_scale << i), 1);
+    u32 h = MAX(WINDOW_HEIGHT / (bloom_scale << i), 1);
+    bloom_canvas[i] = render_new_canvas(w, h, GL_RGBA, GL_RGBA, GL_FLOAT, GL_FALSE, 1);
+  }
 
   // compile shaders
   sprite_shader = shader_load("sprite.glsl");
@@ -219,24 +255,23 @@ void render_render()
   game_render();
   ui_render();
 
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  // bloom, downsample through the chain then upsample back to level 0
+  glDisable(GL_BLEND);
   use_shader(bloom_shader);
-  glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
-  canvas_t *buffers[] = {&vblur_canvas, &hblur_canvas};
-  int buffer = 0;
-  for (int i=0; i<20; i++) {
-    glBindFramebuffer(GL_FRAMEBUFFER, buffers[buffer]->framebuffer);
-    glUniform1i(uniform(active_shader, "u_hor"), buffer);
-
-    if (!i)
-      render_canvas(screen_canvas, 0);
-    else
-      render_canvas(*buffers[!buffer], 0);
-
-    buffer = !buffer;
+  glUniform1i(uniform(active_shader, "u_up"), 0);
+  for (int i=0; i<bloom_passes; i++) {
+    glBindFramebuffer(GL_FRAMEBUFFER, bloom_canvas[i].framebuffer);
+    glViewport(0, 0, bloom_canvas[i].width, bloom_canvas[i].height);
+    render_canvas(i ? bloom_canvas[i-1] : screen_canvas, 0);
+  }
+
+  glUniform1i(uniform(active_shader, "u_up"), 1);
+  for (int i=bloom_passes-1; i>0; i--) {
+    glBindFramebuffer(GL_FRAMEBUFFER, bloom_canvas[i-1].framebuffer);
+    glViewport(0, 0, bloom_canvas[i-1].width, bloom_canvas[i-1].height);
+    render_canvas(bloom_canvas[i], 0);
   }
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  glDisable(GL_BLEND);
 
   // handle upscaling
   float x_scale = (float)window_width() / (float)WINDOW_WIDTH;
@@ -249,7 +284,7 @@ void render_render()
 
   use_shader(quad_shader);
   glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, buffers[buffer]->textures[0]);
+  glBindTexture(GL_TEXTURE_2D, bloom_canvas[0].textures[0]);
   glUniform1i(uniform(active_shader, "u_blur"), 1);
   glUniform1f(uniform(active_shader, "u_time"), (float)game_tick);
 
@@ -258,6 +293,28 @@ void render_render()
   SDL_GL_SwapWindow(window);
 }
 
+double render_time()
+{
+  return (double)SDL_GetPerformanceCounter() / (double)SDL_GetPerformanceFrequency();
+}
+
+void *render_thread(int (*fn)(void*), const char *name, void *data)
+{
+  SDL_Thread *thread = SDL_CreateThread(fn, name, data);
+  if (!thread) {
+    P_ERR("Unable to create thread %s: %s\n", name, SDL_GetError());
+    fn(data);
+  }
+
+  return thread;
+}
+
+void render_thread_wait(void *thread)
+{
+  if (thread)
+    SDL_WaitThread((SDL_Thread*)thread, NULL);
+}
+
 int render_update()
 {
   // handle SDL events
@@ -312,10 +369,10 @@ void render_resize(u32 w, u32 h)
   glClear(GL_COLOR_BUFFER_BIT);
   glBindFramebuffer(GL_FRAMEBUFFER, screen_canvas.framebuffer);
   glClear(GL_COLOR_BUFFER_BIT);
-  glBindFramebuffer(GL_FRAMEBUFFER, hblur_canvas.framebuffer);
-  glClear(GL_COLOR_BUFFER_BIT);
-  glBindFramebuffer(GL_FRAMEBUFFER, vblur_canvas.framebuffer);
-  glClear(GL_COLOR_BUFFER_BIT);
+  for (int i=0; i<bloom_passes; i++) {
+    glBindFramebuffer(GL_FRAMEBUFFER, bloom_canvas[i].framebuffer);
+    glClear(GL_COLOR_BUFFER_BIT);
+  }
 }
 
 void render_clean()
@@ -335,34 +392,11 @@ void render_tilemap(tilesheet_packet_t *packet)
   /----------------- INIT TILEMAP RENDERER --/
   /-----------------------------------------*/
   if (!tilemap.initialized) {
-    glGenVertexArrays(1, &tilemap.vao);
-    glGenBuffers(1, &tilemap.vbo);
-
-    u32 stride = sizeof(GLfloat) * 8;
-
-    glBindVertexArray(tilemap.vao);
-    glBindBuffer(GL_ARRAY_BUFFER, tilemap.vbo);
-
-    // position (2f)
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, (GLvoid*)0);
-
-    // uv (2f)
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(sizeof(GLfloat) * 2));
-
-    // color (4f)
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(sizeof(GLfloat) * 4));
-
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-
     tilemap.texture = texture_load("font.png", 0);
 
-    // pre-generate tile uvs
+    // pre-generate tile uvs, x0 y0 x1 y1 per tile
     tilemap.tile_count = (tilemap.texture->width / TILE_U) * (tilemap.texture->height / TILE_V);
-    tilemap.tile_uv    = malloc(sizeof(float) * (12 * tilemap.tile_count));
+    tilemap.tile_uv    = malloc(sizeof(float) * (4 * tilemap.tile_count));
 
     float x = 1.0f, y = 1.0f;
     for (int i=0; i<tilemap.tile_count; i++) {
@@ -370,16 +404,9 @@ void render_tilemap(tilesheet_packet_t *packet)
       float y0 = y / (float)tilemap.texture->height;
       float x1 = x0 + (TILE_WIDTH / (float)tilemap.texture->width);
       float y1 = y0 + (TILE_HEIGHT / (float)tilemap.texture->height);
-      float uvs[] = {
-        x0, y1,
-        x0, y0,
-        x1, y0,
-        x0, y1,
-        x1, y0,
-        x1, y1
-      };
+      float uvs[] = {x0, y0, x1, y1};
 
-      memcpy(&tilemap.tile_uv[i*12], uvs, sizeof(float)*12);
+      memcpy(&tilemap.tile_uv[i*4], uvs, sizeof(float)*4);
 
       x += TILE_U;
       if (x > tilemap.texture->width) {
@@ -388,19 +415,57 @@ void render_tilemap(tilesheet_packet_t *packet)
       }
     }
 
-    tilemap.rwidth    = packet->rw * (TILE_RWIDTH * packet->zoom);
-    tilemap.rheight   = packet->rh * (TILE_RHEIGHT * packet->zoom);
+    // the sprite shader looks uvs up by tile index
+    glGenBuffers(1, &tilemap.uv_buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, tilemap.uv_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(float) * 4 * tilemap.tile_count, tilemap.tile_uv, GL_STATIC_DRAW);
+    glGenTextures(1, &tilemap.uv_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, tilemap.uv_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, tilemap.uv_buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    tilemap.initialized = 1;
+    P_DBG("Tilemap renderer initialized\n");
+  }
+  /*----------------------------------------*/
+
+
+  /*-----------------------------------------/
+  /----------------- INIT PACKET BUFFER -----/
+  /-----------------------------------------*/
+  // number of tiles we are going to render
+  size_t tcount = packet->rw * packet->rh;
+
+  if (!packet->vao) {
+    glGenVertexArrays(1, &packet->vao);
+    glGenBuffers(1, &packet->vbo);
+
+    u32 stride = sizeof(tile_t);
 
-    tilemap.vertex_count = 48 * packet->rw * packet->rh;
-    u32 bytes       = sizeof(float) * tilemap.vertex_count;
-    tilemap.vertices     = malloc(bytes);
+    glBindVertexArray(packet->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, packet->vbo);
+
+    // tile (1us)
+    glEnableVertexAttribArray(0);
+    glVertexAttribIPointer(0, 1, GL_UNSIGNED_SHORT, stride, (GLvoid*)offsetof(tile_t, tile));
+    glVertexAttribDivisor(0, 1);
+
+    // color (4ub)
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (GLvoid*)offsetof(tile_t, r));
+    glVertexAttribDivisor(1, 1);
 
-    glBindBuffer(GL_ARRAY_BUFFER, tilemap.vbo);
-    glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_DYNAMIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+  }
 
-    tilemap.initialized = 1;
-    P_DBG("Tilemap renderer initialized\n");
+  if (packet->vbo_cells != tcount) {
+    glBindBuffer(GL_ARRAY_BUFFER, packet->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(tile_t) * tcount, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    packet->vbo_cells = tcount;
+    tilesheet_dirty_all(packet);
   }
   /*----------------------------------------*/
 
@@ -412,58 +477,31 @@ void render_tilemap(tilesheet_packet_t *packet)
   float w = TILE_RWIDTH * packet->zoom;
   float h = TILE_RHEIGHT * packet->zoom;
 
-  // number of tiles we are going to render
-  size_t tcount = packet->rw * packet->rh;
-
-  int x = packet->x;
-  int y = packet->y;
-  float rx = 0.0f, ry = 0.0f;
-  for (int i=0; i<tcount; i++) {
-    size_t index = i*48;
-
-    if (x < 0 || y < 0)
-      goto next;
-
-    // get tile index
-    size_t tindex = (y * packet->w) + x;
-    size_t tile = 0;
-    vec4 rgb = {0.0f};
-    if (tindex >= 0 && tindex <= packet->w * packet->h) {
-      tile = packet->tiles[tindex].tile;
-      rgb[0] = (float)packet->tiles[tindex].r / 255.0f;
-      rgb[1] = (float)packet->tiles[tindex].g / 255.0f;
-      rgb[2] = (float)packet->tiles[tindex].b / 255.0f;
-      rgb[3] = (float)packet->tiles[tindex].a / 255.0f;
+  // cells in view, the whole packet can go up as is
+  tile_t *cells = packet->tiles;
+  size_t lo = MIN(packet->dirty_lo, tcount), hi = MIN(packet->dirty_hi, tcount);
+  if (lo < hi && (packet->x || packet->y || packet->rw != packet->w || packet->rh != packet->h)) {
+    if (tilemap.cell_count < tcount) {
+      tilemap.cells = realloc(tilemap.cells, sizeof(tile_t) * tcount);
+      tilemap.cell_count = tcount;
     }
-    tile *= 12;
-    
-    if (!tile)
-      rgb[3] = 0.0f;
-
-    GLfloat vertices[] = {
-      // pos      // uv                                              // color
-      rx  , ry+h, tilemap.tile_uv[tile+0],  tilemap.tile_uv[tile+1], rgb[0], rgb[1], rgb[2], rgb[3],
-      rx  , ry  , tilemap.tile_uv[tile+2],  tilemap.tile_uv[tile+3], rgb[0], rgb[1], rgb[2], rgb[3],
-      rx+w, ry  , tilemap.tile_uv[tile+4],  tilemap.tile_uv[tile+5], rgb[0], rgb[1], rgb[2], rgb[3], 
-      rx  , ry+h, tilemap.tile_uv[tile+6],  tilemap.tile_uv[tile+7], rgb[0], rgb[1], rgb[2], rgb[3],
-      rx+w, ry  , tilemap.tile_uv[tile+8],  tilemap.tile_uv[tile+9], rgb[0], rgb[1], rgb[2], rgb[3],
-      rx+w, ry+h, tilemap.tile_uv[tile+10], tilemap.tile_uv[tile+11], rgb[0], rgb[1], rgb[2], rgb[3]
-    };
 
-    memcpy(&tilemap.vertices[index], vertices, sizeof(float)*48);
-
-    next:
-    x  += 1;
-    rx += w;
-    if (rx >= packet->rw * w || x >= packet->w) {
-      x  = packet->x;
-      y  += 1;
-      rx = 0.0f;
-      ry += h;
-    }
-    if (ry >= packet->rh * h || y >= packet->h) {
-      break;
+    cells = tilemap.cells;
+    memset(cells, 0, sizeof(tile_t) * tcount);
+    for (int ry=0; ry<packet->rh; ry++) {
+      int y = packet->y + ry;
+      if (y < 0 || y >= packet->h)
+        continue;
+
+      for (int rx=0; rx<packet->rw; rx++) {
+        int x = packet->x + rx;
+        if (x >= 0 && x < packet->w)
+          cells[(ry * packet->rw) + rx] = packet->tiles[(y * packet->w) + x];
+      }
     }
+
+    // dirty cells are in packet space, resend the whole view
+    lo = 0, hi = tcount;
   }
 
   mat4x4_identity(tilemap.transform);
@@ -473,23 +511,30 @@ void render_tilemap(tilesheet_packet_t *packet)
   use_shader(sprite_shader);
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, tilemap.texture->id);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_BUFFER, tilemap.uv_texture);
 
   // send uniforms
   glUniform2f(uniform(active_shader, "u_uv"), 0.0f, 0.0f);
+  glUniform2f(uniform(active_shader, "u_size"), w, h);
+  glUniform1i(uniform(active_shader, "u_columns"), packet->rw);
   glUniform4f(uniform(active_shader, "u_color"), 1.0f, 1.0f, 1.0f, 1.0f);
   glUniform1i(uniform(active_shader, "u_texture"), 0);
+  glUniform1i(uniform(active_shader, "u_tile_uv"), 1);
   glUniformMatrix4fv(uniform(active_shader, "u_projection"), 1, GL_FALSE, projection[0]);
   glUniformMatrix4fv(uniform(active_shader, "u_model"), 1, GL_FALSE, tilemap.transform[0]);
 
-  // update vbo
-  glBindBuffer(GL_ARRAY_BUFFER, tilemap.vbo);
-  GLvoid *ptr = glMapBufferRange(GL_ARRAY_BUFFER, 0, sizeof(GLfloat)*tilemap.vertex_count, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
-  memcpy(ptr, tilemap.vertices, sizeof(GLfloat)*tilemap.vertex_count);
-  glUnmapBuffer(GL_ARRAY_BUFFER);
+  // update changed cells only, nothing at all if the packet is clean
+  if (lo < hi) {
+    glBindBuffer(GL_ARRAY_BUFFER, packet->vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(tile_t)*lo, sizeof(tile_t)*(hi-lo), &cells[lo]);
+  }
+  packet->dirty_lo = packet->dirty_hi = 0;
 
-  // draw tris
-  glBindVertexArray(tilemap.vao);
-  glDrawArrays(GL_TRIANGLES, 0, tilemap.vertex_count/4);
+  // draw one quad per cell
+  glBindVertexArray(packet->vao);
+  glDrawArraysInstanced(GL_TRIANGLES, 0, 6, tcount);
+  glActiveTexture(GL_TEXTURE0);
   /*----------------------------------------*/
 }
 /*----------------------------------------*/
@@ -30,6 +30,9 @@ typedef struct {
   int x, y; // render centered on x and y
   int rx, ry; // render to screen at rx and ry
   int rw, rh; // render area size on screen
+  GLuint vao, vbo; // per-cell instance buffer, created on first draw
+  size_t vbo_cells;
+  size_t dirty_lo, dirty_hi; // cells changed since the last upload
 } tilesheet_packet_t;
 
 extern tilesheet_packet_t packet;
@@ -44,13 +47,30 @@ void render_clean();
 
 void render_tilemap(tilesheet_packet_t *packet);
 
-// helper getters
+// seconds since an arbitrary start, for frame timing
+double render_time();
+
+/**
+ * [render_thread run fn on a worker thread]
+ * @param  fn   [thread body]
+ * @param  name [thread name for debuggers]
+ * @param  data [passed to fn]
+ * @return      [handle for render_thread_wait, NULL when fn ran inline]
+ */
+void *render_thread(int (*fn)(void*), const char *name, void *data);
+
+// block until a render_thread handle finishes, NULL is a no-op
+void render_thread_wait(void *thread);
+
+// helper getters, handles are resolved from conf in render_init
+extern float *conf_window_width, *conf_window_height;
+
 static inline u32 window_width() {
-  return (u32)ini_get_float(conf, "graphics", "window_width");
+  return (u32)*conf_window_width;
 }
 
 static inline u32 window_height() {
-  return (u32)ini_get_float(conf, "graphics", "window_height");
+  return (u32)*conf_window_height;
 }
 
 static inline u32 to_index(u32 x, u32 y)
@@ -60,6 +80,31 @@ static inline u32 to_index(u32 x, u32 y)
   return (y * TILES_X) + x; 
 }
 
+// dirty tracking, writers to packet->tiles mark what they touched
+static inline void tilesheet_dirty(tilesheet_packet_t *packet, u32 index)
+{
+  if (packet->dirty_lo >= packet->dirty_hi) {
+    packet->dirty_lo = index;
+    packet->dirty_hi = index + 1;
+    return;
+  }
+
+  packet->dirty_lo = MIN(packet->dirty_lo, index);
+  packet->dirty_hi = MAX(packet->dirty_hi, index + 1);
+}
+
+static inline void tilesheet_dirty_rect(tilesheet_packet_t *packet, u32 x0, u32 y0, u32 x1, u32 y1)
+{
+  tilesheet_dirty(packet, (y0 * packet->w) + x0);
+  tilesheet_dirty(packet, (y1 * packet->w) + x1);
+}
+
+static inline void tilesheet_dirty_all(tilesheet_packet_t *packet)
+{
+  packet->dirty_lo = 0;
+  packet->dirty_hi = packet->w * packet->h;
+}
+
 void render_translate_mouse(int *mx, int *my);
 
 #endif // RENDER_H
\ No newline at end of file
@@ -10,11 +10,18 @@
 #define VGA_FONT_HEIGHT 16
 #define VGA_WIDTH  432
 #define VGA_HEIGHT 261
+#define VGA_COLS   (VGA_WIDTH / VGA_FONT_WIDTH)
+#define VGA_ROWS   (VGA_HEIGHT / VGA_FONT_HEIGHT)
 
-static u32 *vga_data = NULL;
+// one texel of the cell texture, colors are packed abgr like vga_fg/bg
+typedef struct {
+  u32 glyph, fg, bg;
+} vga_cell_t;
+
+static vga_cell_t *vga_data = NULL;
 static u32 vga_fg = 0xFFFFFFFF, vga_bg = 0x00000000;
-static size_t vga_len = 0;
-static GLuint texture, shader, vao, vbo;
+static int vga_dirty = 0;
+static GLuint texture, font, shader, vao, vbo;
 static GLfloat vertices[24];
 static mat4x4 projection;
 
@@ -23,24 +30,34 @@ void vga_init()
   if (vga_data) {
     free(vga_data);
   } else {
-    // gen texture
+    // cell texture, glyph index and colors per character
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
     glTexImage2D(GL_TEXTURE_2D, 0,
-      GL_RGBA, VGA_WIDTH, VGA_HEIGHT, 0,
-      GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+      GL_RGB32UI, VGA_COLS, VGA_ROWS, 0,
+      GL_RGB_INTEGER, GL_UNSIGNED_INT, NULL);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    // glyph atlas, one byte per glyph row with one row per glyph
+    glGenTextures(1, &font);
+    glBindTexture(GL_TEXTURE_2D, font);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0,
+      GL_R8UI, VGA_FONT_HEIGHT, VGA_FONT_DATA_LEN / VGA_FONT_HEIGHT, 0,
+      GL_RED_INTEGER, GL_UNSIGNED_BYTE, vga_font_array);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
     // load shader
     shader = shader_load("vga.glsl");
 
     // set up vao, vbo etc
-    float w = VGA_WIDTH;
-    float h = VGA_HEIGHT;
+    float w = VGA_COLS * VGA_FONT_WIDTH;
+    float h = VGA_ROWS * VGA_FONT_HEIGHT;
     float u0 = 0.0f, v0 = 0.0f;
     float u1 = 1.0, v1 = 1.0;
     GLfloat v[] = {
@@ -74,52 +91,32 @@ void vga_init()
     glBindVertexArray(0);
   }
 
-  // calculate vga data len
-  vga_len = VGA_FONT_WIDTH * VGA_FONT_HEIGHT;
-  vga_len *= VGA_WIDTH * VGA_HEIGHT;
-
-  // malloc a large buffer for the pixel data
-  vga_data = malloc(sizeof(u32) * vga_len);
-  memset(vga_data, 0, sizeof(u32) * vga_len);
+  // a few kilobytes of cells, the shader expands them into pixels
+  vga_data = calloc(VGA_COLS * VGA_ROWS, sizeof(vga_cell_t));
+  vga_dirty = 1;
 
   P_DBG("VGA system initialized\n");
 }
 
 void vga_print(size_t x, size_t y, const char *str)
 {
-  x *= VGA_FONT_WIDTH;
-  y *= VGA_FONT_HEIGHT;
-
-  u8 *font = vga_font_array;
-  for (int i=0; i<strlen(str); i++) {
-    size_t c = (str[i]*16);
-
-    if (c > VGA_FONT_DATA_LEN)
-      c = 0;
-
-    if (x >= VGA_WIDTH * VGA_FONT_WIDTH) {
+  for (int i=0; str[i]; i++) {
+    if (x >= VGA_COLS) {
       x = 0;
-      y += VGA_FONT_HEIGHT;
+      y++;
     }
-    if (y >= VGA_HEIGHT * VGA_FONT_HEIGHT)
+    if (y >= VGA_ROWS)
       y = 0;
 
-    for (int j=0; j<16; j++) {
-      size_t p = (VGA_WIDTH * y) + x;
-      p += (VGA_WIDTH * j);
-      u8 byte = font[c+j];
-
-      for (int k=0; k<8; k++) {
-        int color = (byte >> k) & 0x01;
-        if (color)
-          vga_data[p+(8-k)] = vga_fg;
-        else
-          vga_data[p+(8-k)] = vga_bg;
-      }
-    }
+    vga_cell_t *cell = &vga_data[(y * VGA_COLS) + x];
+    cell->glyph = (u8)str[i];
+    cell->fg    = vga_fg;
+    cell->bg    = vga_bg;
 
-    x += VGA_FONT_WIDTH;
+    x++;
   }
+
+  vga_dirty = 1;
 }
 
 void vga_render()
@@ -127,16 +124,24 @@ void vga_render()
   mat4x4_ortho(projection, 0.0f, WINDOW_WIDTH, WINDOW_HEIGHT, 0.0f, -1.0f, 1.0f);
   glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
 
-  glBindTexture(GL_TEXTURE_2D, texture);
-  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
-    VGA_WIDTH, VGA_HEIGHT,
-    GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV, vga_data);
+  // only upload when text has changed
+  if (vga_dirty) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+      VGA_COLS, VGA_ROWS,
+      GL_RGB_INTEGER, GL_UNSIGNED_INT, vga_data);
+    vga_dirty = 0;
+  }
 
   glUseProgram(shader);
   glBindVertexArray(vao);
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, texture);
-  glUniform1i(uniform(shader, "u_texture"), 0);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, font);
+  glUniform1i(uniform(shader, "u_cells"), 0);
+  glUniform1i(uniform(shader, "u_font"), 1);
+  glUniform2i(uniform(shader, "u_glyph"), VGA_FONT_WIDTH, VGA_FONT_HEIGHT);
   glUniformMatrix4fv(uniform(shader, "u_projection"), 1, GL_FALSE, projection[0]);
   glDisable(GL_DEPTH_TEST);
   glDisable(GL_CULL_FACE);
@@ -147,11 +152,14 @@ void vga_render()
 
   glBindVertexArray(0);
   glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void vga_clear()
 {
-  memset(vga_data, 0, sizeof(u32) * vga_len);
+  memset(vga_data, 0, sizeof(vga_cell_t) * VGA_COLS * VGA_ROWS);
+  vga_dirty = 1;
 }
 
 void vga_setfg(u8 r, u8 g, u8 b, u8 a)
@@ -176,6 +184,8 @@ void vga_clean()
     P_DBG("Cleaning up vga\n");
     free(vga_data);
 
+    glDeleteTextures(1, &texture);
+    glDeleteTextures(1, &font);
     glDeleteVertexArrays(1, &vao);
     glDeleteBuffers(1, &vbo);
   }
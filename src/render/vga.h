@@ -30,7 +30,7 @@ void vga_print(size_t x, size_t y, const char *str);
 void vga_render();
 
 /**
- * [vga_clear clear the vga pixel data]
+ * [vga_clear clear the vga character cells]
  */
 void vga_clear();
 
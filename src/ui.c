@@ -197,6 +197,7 @@ int ui_print(const char *str, u32 x, u32 y, u8 r, u8 g, u8 b, u8 a)
     ui_tiles.tiles[index].g    = g;
     ui_tiles.tiles[index].b    = b;
     ui_tiles.tiles[index].a    = a;
+    tilesheet_dirty(&ui_tiles, index);
     x++;
     count++;
 
@@ -261,6 +262,7 @@ void ui_inventory(entity_t *e)
     }
 
     ui_tiles.tiles[(y*ui_tiles.w)+x+len].tile = tile;
+    tilesheet_dirty(&ui_tiles, (y*ui_tiles.w)+x+len);
     if (!item_info[item].identified) {
       ui_tiles.tiles[(y*ui_tiles.w)+x+len].tile = 43;
       ui_tiles.tiles[(y*ui_tiles.w)+x+len].r = 160;
@@ -440,6 +442,7 @@ void ui_item(entity_t *e, int item)
   ui_tiles.tiles[(y*ui_tiles.w)+x+12].b = 255;
   ui_tiles.tiles[(y*ui_tiles.w)+x+13].tile = 75;
   ui_tiles.tiles[(y*ui_tiles.w)+x+11].tile = 74;
+  tilesheet_dirty_rect(&ui_tiles, x+11, y, x+13, y);
 
   ui_rendering = 1;
   ui_state = UI_STATE_ITEM;
@@ -506,7 +509,7 @@ void ui_inspect(entity_t *e)
 {
   ui_reset();
 
-  if (strlen(e->description) < 1)
+  if (!e->description)
     return;
 
   int tile = e->renderable.tile;
@@ -517,14 +520,14 @@ void ui_inspect(entity_t *e)
 
   ui_print("{_______________________}", x, y, 100, 100, 120, 255);
   
-  sprintf(buf, ">%s<", e->name);
+  sprintf(buf, ">%s<", entity_string(e->name));
   ui_print(buf, x+2, y++, 100, 100, 120, 255);
 
   ui_print("|                       |", x, y, 100, 100, 120, 255);
 
   // description
   ui_maxlen = 22;
-  sprintf(buf, "%s", e->description);
+  sprintf(buf, "%s", entity_string(e->description));
   int count = ui_print(buf, x+1, y, 100, 100, 120, 255);
   ui_maxlen = 0;
   for (int i=0; i<=count+1; i++) {
@@ -561,6 +564,7 @@ void ui_inspect(entity_t *e)
   ui_tiles.tiles[(y*ui_tiles.w)+x+12].b = 255;
   ui_tiles.tiles[(y*ui_tiles.w)+x+13].tile = 75;
   ui_tiles.tiles[(y*ui_tiles.w)+x+11].tile = 74;
+  tilesheet_dirty_rect(&ui_tiles, x+11, y, x+13, y);
 
   ui_rendering = 1;
   ui_state = UI_STATE_INSPECT;
@@ -665,6 +669,7 @@ void ui_end()
 void ui_reset()
 {
   memset(ui_tiles.tiles, 0, sizeof(tile_t) * ui_tiles.w * ui_tiles.h);
+  tilesheet_dirty_all(&ui_tiles);
   ui_rendering = 0;
   ui_state = UI_STATE_NONE;
 }
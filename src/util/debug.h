@@ -2,7 +2,9 @@
 #define DEBUG_H
 
 // toggle to hide debug output
+#ifndef NO_DEBUG_PRINTING
 #define DEBUG_PRINTING
+#endif
 
 #include <stdio.h>
 
@@ -1,5 +1,69 @@
 #include "ini.h"
 #include "io.h"
+#include "math/linmath.h"
+
+/*---------------- HELPERS ---------------*/
+static inline ini_var_t *ini_var(ini_t *ini, u32 index)
+{
+  return &ini->pages[index / INI_PAGE_SIZE][index % INI_PAGE_SIZE];
+}
+
+static inline const char *ini_name(ini_t *ini, ini_var_t *var)
+{
+  return &ini->strings[var->name];
+}
+
+// fnv-1a over section and key, with the separator hashed too
+static u32 ini_hash(const char *sec, const char *key)
+{
+  u32 hash = 2166136261u;
+  for (const char *c = sec; *c; c++)
+    hash = (hash ^ (u8)*c) * 16777619u;
+  hash = (hash ^ 0) * 16777619u;
+  for (const char *c = key; *c; c++)
+    hash = (hash ^ (u8)*c) * 16777619u;
+  return hash;
+}
+
+// copy len bytes plus a terminator into the string arena
+static u32 ini_intern(ini_t *ini, const char *str, size_t len)
+{
+  if (ini->strings_len + len + 1 > ini->strings_cap) {
+    ini->strings_cap = MAX(ini->strings_cap * 2, ini->strings_len + len + 1);
+    ini->strings_cap = MAX(ini->strings_cap, 256);
+    ini->strings = realloc(ini->strings, ini->strings_cap);
+  }
+
+  u32 offset = ini->strings_len;
+  memcpy(&ini->strings[offset], str, len);
+  ini->strings[offset + len] = '\0';
+  ini->strings_len += len + 1;
+  return offset;
+}
+
+static void ini_insert(ini_t *ini, u32 index)
+{
+  u32 mask = ini->table_size - 1;
+  u32 slot = ini_var(ini, index)->hash & mask;
+  while (ini->table[slot])
+    slot = (slot + 1) & mask;
+  ini->table[slot] = index + 1;
+}
+
+// keep the table at most half full
+static void ini_grow(ini_t *ini)
+{
+  if ((ini->count + 1) * 2 <= ini->table_size)
+    return;
+
+  free(ini->table);
+  ini->table_size = MAX(ini->table_size * 2, 64);
+  ini->table = calloc(ini->table_size, sizeof(u32));
+  for (u32 i=0; i<ini->count; i++)
+    ini_insert(ini, i);
+}
+/*----------------------------------------*/
+
 
 ERR ini_load(ini_t *ini, const char *path)
 {
@@ -18,73 +82,29 @@ ERR ini_load(ini_t *ini, const char *path)
   buff[j] = '\0';
 
   // tokenize buffer
-  int cur_section = -1;
+  char section[256] = {0};
   char *token = strtok(buff, "\t\n");
   while (token) {
     // check if section
     if (token[0] == '[' && token[strlen(token)-1] == ']') {
-      char section[256] = {0};
-      strncpy(section, &token[1], strlen(token)-2);
-
-      // attempt set active section
-      int i;
-      for (i=0; i<ini->length; i++) {
-        if (strcmp(ini->sections[i].name, section) == 0) {
-          cur_section = i;
-          break;
-        }
-      }
-
-      // no section found, make it
-      if (i == ini->length) {
-        strcpy(ini->sections[ini->length].name, section);
-        ini->sections[ini->length].length = 0;
-        cur_section = ini->length;
-        ini->length++;
-      }
+      memset(section, 0, sizeof(section));
+      strncpy(section, &token[1], MIN(strlen(token)-2, sizeof(section)-1));
     }
 
     // get keys and values
     char *e, *key, *value;
-    if ((e = strstr(token, "="))) {
+    if ((e = strstr(token, "=")) && section[0]) {
       key = token;
       value = &e[1];
       e[0] = '\0';
 
-      if (cur_section > -1) {
-        ini_section_t *section = &ini->sections[cur_section];
-
-        // check to see if key already exists
-        ini_var_t *cur_var = NULL;
-        for (int i=0; i<section->length; i++) {
-          // key found
-          if (strcmp(section->vars[i].key, key) == 0) {
-            cur_var = &section->vars[i];
-            break;
-          }
-        }
-
-        // no key found, make it
-        if (!cur_var) {
-          strcpy(section->vars[section->length].key, key);
-          cur_var = &section->vars[section->length];
-          section->length++;
-        }
-
-        // insert key-value pair into section
-        if (cur_var) {
-          // is it a number?
-          char *p;
-          strtod(value, &p);
-          if (*p == '\0') {
-            cur_var->f = strtof(value, NULL);
-            cur_var->type = ini_type_float;
-          } else {
-            strcpy(cur_var->s, value);
-            cur_var->type = ini_type_string;
-          }
-        }
-      }
+      // is it a number?
+      char *p;
+      strtod(value, &p);
+      if (*p == '\0')
+        ini_set_float(ini, section, key, strtof(value, NULL));
+      else
+        ini_set_string(ini, section, key, value);
     }
 
     token = strtok(NULL, "\t\n");
@@ -96,100 +116,107 @@ ERR ini_load(ini_t *ini, const char *path)
 
 ERR ini_save(ini_t *ini, const char *path)
 {
-  // empty the file
-  io_write(path, "", 0, 0);
-
   P_DBG("Saving configuration file to %s\n", path);
 
-  // now save the actual data
-  char buf[1024];
-  for (int i=0; i<ini->length; i++) {
-    ini_section_t *section = &ini->sections[i];
+  // buffer the whole file, grouped by section in first seen order
+  io_writer_t w;
+  io_writer_open(&w, path);
+  for (int i=0; i<ini->count; i++) {
+    const char *sec = ini_name(ini, ini_var(ini, i));
+
+    int seen = 0;
+    for (int j=0; j<i && !seen; j++)
+      seen = strcmp(ini_name(ini, ini_var(ini, j)), sec) == 0;
+    if (seen)
+      continue;
 
     // write section
-    sprintf(buf, "[%s]\n", section->name);
-    io_write(path, buf, strlen(buf), 1);
+    io_writer_printf(&w, "[%s]\n", sec);
 
-    for (int j=0; j<section->length; j++) {
-      ini_var_t *var = &section->vars[j];
+    for (int j=i; j<ini->count; j++) {
+      ini_var_t *var = ini_var(ini, j);
+      const char *name = ini_name(ini, var);
+      if (strcmp(name, sec) != 0)
+        continue;
 
-      // format a buffer for writing
+      // write a key-value pair
+      const char *key = &name[strlen(name)+1];
       switch (var->type) {
         case ini_type_string: {
-          sprintf(buf, "%s = %s\n", var->key, var->s);
+          io_writer_printf(&w, "%s = %s\n", key, &ini->strings[var->s]);
           break;
         }
         case ini_type_float: {
-          sprintf(buf, "%s = %.2f\n", var->key, var->f);
+          io_writer_printf(&w, "%s = %.2f\n", key, var->f);
           break;
         }
         case ini_type_undefined: {
           break;
         }
       }
-
-      // write a key-value pair
-      io_write(path, buf, strlen(buf), 1);
     }
 
-    io_write(path, "\n", 1, 1);
+    io_writer_write(&w, "\n", 1);
   }
 
-  return SUCCESS;
+  return io_writer_close(&w);
 }
 
-ini_var_t *ini_new_var(ini_t *ini, const char *sec, const char *key)
+void ini_free(ini_t *ini)
 {
-  ini_section_t *section = NULL;
-  ini_var_t *var = NULL;
-
-  // see if section already exists
-  for (int i=0; i<ini->length; i++) {
-    if (strcmp(ini->sections[i].name, sec) == 0) {
-      section = &ini->sections[i];
-      break;
-    }
-  }
+  for (u32 i=0; i<ini->count; i += INI_PAGE_SIZE)
+    free(ini->pages[i / INI_PAGE_SIZE]);
 
-  // no section found, make it
-  if (!section) {
-    strcpy(ini->sections[ini->length].name, sec);
-    ini->sections[ini->length].length = 0;
-    ini->length++;
-  }
+  free(ini->pages);
+  free(ini->table);
+  free(ini->strings);
+  memset(ini, 0, sizeof(ini_t));
+}
 
-  // something bad happened
-  if (!section)
-    return NULL;
+ini_var_t *ini_new_var(ini_t *ini, const char *sec, const char *key, u32 hash)
+{
+  ini_grow(ini);
 
-  // add the key
-  var = &section->vars[section->length];
-  strcpy(var->key, key);
-  section->length++;
+  // start a new page when the last one is full
+  if (ini->count % INI_PAGE_SIZE == 0) {
+    u32 page = ini->count / INI_PAGE_SIZE;
+    ini->pages = realloc(ini->pages, sizeof(ini_var_t*) * (page + 1));
+    ini->pages[page] = malloc(sizeof(ini_var_t) * INI_PAGE_SIZE);
+  }
 
+  // intern "section\0key"
+  size_t sec_len = strlen(sec);
+  ini_var_t *var = ini_var(ini, ini->count);
+  var->hash = hash;
+  var->name = ini_intern(ini, sec, sec_len);
+  ini_intern(ini, key, strlen(key));
   var->type = ini_type_undefined;
+  var->s = 0;
+
+  ini_insert(ini, ini->count++);
 
   return var;
 }
 
 ini_var_t *ini_get_var(ini_t *ini, const char *sec, const char *key)
 {
-  for (int i=0; i<ini->length; i++) {
-    ini_section_t *section = &ini->sections[i];
+  u32 hash = ini_hash(sec, key);
 
-    if (strcmp(section->name, sec) != 0)
-      continue;
+  if (ini->table_size) {
+    u32 mask = ini->table_size - 1;
+    for (u32 slot = hash & mask; ini->table[slot]; slot = (slot + 1) & mask) {
+      ini_var_t *var = ini_var(ini, ini->table[slot] - 1);
+      if (var->hash != hash)
+        continue;
 
-    for (int j=0; j<section->length; j++) {
-      ini_var_t *var = &section->vars[j];
-      if (strcmp(var->key, key) == 0) {
+      const char *name = ini_name(ini, var);
+      if (strcmp(name, sec) == 0 && strcmp(&name[strlen(name)+1], key) == 0)
         return var;
-      }
     }
   }
 
   // no var found, make one
-  return ini_new_var(ini, sec, key);
+  return ini_new_var(ini, sec, key, hash);
 }
 
 char *ini_get_string(ini_t *ini, const char *sec, const char *key)
@@ -197,7 +224,7 @@ char *ini_get_string(ini_t *ini, const char *sec, const char *key)
   ini_var_t *var = ini_get_var(ini, sec, key);
 
   if (var && var->type == ini_type_string)
-    return var->s;
+    return &ini->strings[var->s];
 
   return "";
 }
@@ -212,14 +239,31 @@ float ini_get_float(ini_t *ini, const char *sec, const char *key)
   return 0.0f;
 }
 
+float *ini_get_float_handle(ini_t *ini, const char *sec, const char *key)
+{
+  ini_var_t *var = ini_get_var(ini, sec, key);
+
+  if (var->type != ini_type_float) {
+    var->type = ini_type_float;
+    var->f = 0.0f;
+  }
+
+  return &var->f;
+}
+
 void ini_set_string(ini_t *ini, const char *sec, const char *key, const char *value)
 {
   ini_var_t *var = ini_get_var(ini, sec, key);
 
-  if (var) {
-    var->type = ini_type_string;
-    strcpy(var->s, value);
+  // reuse the old slot when the new value fits
+  size_t len = strlen(value);
+  if (var->type == ini_type_string && strlen(&ini->strings[var->s]) >= len) {
+    strcpy(&ini->strings[var->s], value);
+    return;
   }
+
+  var->type = ini_type_string;
+  var->s = ini_intern(ini, value, len);
 }
 
 void ini_set_float(ini_t *ini, const char *sec, const char *key, const float value)
@@ -230,4 +274,4 @@ void ini_set_float(ini_t *ini, const char *sec, const char *key, const float val
     var->type = ini_type_float;
     var->f = value;
   }
-}
\ No newline at end of file
+}
@@ -22,6 +22,7 @@
 #define INI_H
 
 #include "util/debug.h"
+#include "types.h"
 
 #include <inttypes.h>
 #include <stdlib.h>
@@ -35,23 +36,24 @@ typedef enum {
 } ini_type_e;
 
 typedef struct {
-  char key[256];
+  u32 hash, name; // name is "section\0key" in the string arena
   ini_type_e type;
   union {
-    char s[256];
+    u32 s; // string arena offset
     float f;
   };
 } ini_var_t;
 
-typedef struct {
-  ini_var_t vars[256];
-  char name[256];
-  int length;
-} ini_section_t;
+// vars live in fixed size pages so pointers into them never move
+#define INI_PAGE_SIZE 64
 
 typedef struct {
-  ini_section_t sections[256];
-  int length, success;
+  ini_var_t **pages;
+  u32 count;
+  u32 *table, table_size; // open addressing, var index + 1, 0 is empty
+  char *strings;
+  u32 strings_len, strings_cap;
+  int success;
 } ini_t;
 
 /**
@@ -70,7 +72,13 @@ ERR ini_load(ini_t *ini, const char *path);
 ERR ini_save(ini_t *ini, const char *path);
 
 /**
- * [ini_get_var get a key-value variable]
+ * [ini_free free everything owned by the ini, leaves it empty]
+ * @param ini [ini instance to use]
+ */
+void ini_free(ini_t *ini);
+
+/**
+ * [ini_get_var get a key-value variable, created if missing]
  * @param  ini [ini instance to use]
  * @param  sec [variable section]
  * @param  key [variable key]
@@ -83,7 +91,7 @@ ini_var_t *ini_get_var(ini_t *ini, const char *sec, const char *key);
  * @param  ini [ini instance to use]
  * @param  sec [variable section]
  * @param  key [variable key]
- * @return     [string pointer]
+ * @return     [string pointer, valid until the next ini call that creates a var or sets a string]
  */
 char *ini_get_string(ini_t *ini, const char *sec, const char *key);
 
@@ -96,6 +104,15 @@ char *ini_get_string(ini_t *ini, const char *sec, const char *key);
  */
 float ini_get_float(ini_t *ini, const char *sec, const char *key);
 
+/**
+ * [ini_get_float_handle resolve a float variable once for repeated reads]
+ * @param  ini [ini instance to use]
+ * @param  sec [variable section]
+ * @param  key [variable key]
+ * @return     [value pointer, valid until ini_free]
+ */
+float *ini_get_float_handle(ini_t *ini, const char *sec, const char *key);
+
 /**
  * [ini_set_string set a string variable]
  * @param ini   [ini instance to use]
@@ -7,12 +7,21 @@
 #define IO_H
 
 #include "util/debug.h"
+#include "types.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <physfs.h>
 
+// buffered writer, everything goes to disk with a single open on close
+typedef struct {
+  char path[256];
+  char *data;
+  size_t len, cap;
+} io_writer_t;
+
 /**
  * [io_read reads a file into a char array]
  * @param  path [file path]
@@ -117,4 +126,104 @@ static inline void io_write(const char *path, const void *data, size_t len, int
   PHYSFS_close(file);
 }
 
+/**
+ * [io_writer_open start buffering writes for a file]
+ * @param w    [writer to use]
+ * @param path [file path in the write dir]
+ */
+static inline void io_writer_open(io_writer_t *w, const char *path)
+{
+  memset(w, 0, sizeof(io_writer_t));
+  strncpy(w->path, path, sizeof(w->path)-1);
+}
+
+// grow the writer buffer to fit len more bytes
+static inline void io_writer_reserve(io_writer_t *w, size_t len)
+{
+  if (w->len + len <= w->cap)
+    return;
+
+  w->cap = w->cap ? w->cap * 2 : 1024;
+  if (w->cap < w->len + len)
+    w->cap = w->len + len;
+  w->data = realloc(w->data, w->cap);
+}
+
+/**
+ * [io_writer_write append bytes to the writer buffer]
+ * @param w    [writer to use]
+ * @param data [data to write]
+ * @param len  [length of data]
+ */
+static inline void io_writer_write(io_writer_t *w, const void *data, size_t len)
+{
+  io_writer_reserve(w, len);
+  memcpy(&w->data[w->len], data, len);
+  w->len += len;
+}
+
+/**
+ * [io_writer_printf append formatted text to the writer buffer]
+ * @param w   [writer to use]
+ * @param fmt [printf style format]
+ */
+static inline void io_writer_printf(io_writer_t *w, const char *fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(NULL, 0, fmt, args);
+  va_end(args);
+
+  if (len <= 0)
+    return;
+
+  // format straight into the buffer, room for the terminator too
+  io_writer_reserve(w, len + 1);
+  va_start(args, fmt);
+  vsnprintf(&w->data[w->len], len + 1, fmt, args);
+  va_end(args);
+  w->len += len;
+}
+
+/**
+ * [io_writer_close write the buffer to path.tmp then rename it over path]
+ * @param  w [writer to use, its buffer is freed]
+ * @return   [SUCCESS if the file was replaced]
+ */
+static inline ERR io_writer_close(io_writer_t *w)
+{
+  ERR err = FAILURE;
+  char tmp[264];
+  sprintf(tmp, "%s.tmp", w->path);
+
+  PHYSFS_File *file = PHYSFS_openWrite(tmp);
+  if (!file) {
+    P_ERR("Unable to open file %s for writing\n", tmp);
+  } else {
+    PHYSFS_sint64 written = PHYSFS_writeBytes(file, w->data, w->len);
+    if (!PHYSFS_close(file) || written < (PHYSFS_sint64)w->len) {
+      P_ERR("Unable to write bytes to file %s\n", tmp);
+    } else {
+      // physfs has no rename, go through the real write dir
+      char from[1024], to[1024];
+      const char *dir = PHYSFS_getWriteDir(), *sep = PHYSFS_getDirSeparator();
+      snprintf(from, sizeof(from), "%s%s%s", dir, sep, tmp);
+      snprintf(to, sizeof(to), "%s%s%s", dir, sep, w->path);
+#ifdef _WIN32
+      remove(to);
+#endif
+      if (rename(from, to) == 0)
+        err = SUCCESS;
+      else
+        P_ERR("Unable to replace file %s\n", w->path);
+    }
+  }
+
+  free(w->data);
+  w->data = NULL;
+  w->len = w->cap = 0;
+
+  return err;
+}
+
 #endif // IO_H
\ No newline at end of file
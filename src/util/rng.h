@@ -0,0 +1,50 @@
+/* rng
+  Small PCG32 generator, each user owns its state so
+  nothing depends on the shared libc rand() sequence.
+*/
+
+#ifndef RNG_H
+#define RNG_H
+
+#include "types.h"
+
+typedef struct {
+  u64 state, inc;
+} rng_t;
+
+/**
+ * [rng_next next 32 bits of the sequence]
+ * @param  rng [generator state]
+ * @return     [uniform u32]
+ */
+static inline u32 rng_next(rng_t *rng)
+{
+  u64 old = rng->state;
+  rng->state = old * 6364136223846793005ull + rng->inc;
+  u32 xorshifted = (u32)(((old >> 18u) ^ old) >> 27u);
+  u32 rot = (u32)(old >> 59u);
+  return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+/**
+ * [rng_seed start a sequence]
+ * @param rng    [generator state]
+ * @param seed   [starting point]
+ * @param stream [sequence selector, different streams never overlap]
+ */
+static inline void rng_seed(rng_t *rng, u64 seed, u64 stream)
+{
+  rng->state = 0;
+  rng->inc = (stream << 1u) | 1u;
+  rng_next(rng);
+  rng->state += seed;
+  rng_next(rng);
+}
+
+// drop in for rand(), non-negative int
+static inline int rng_rand(rng_t *rng)
+{
+  return (int)(rng_next(rng) >> 1);
+}
+
+#endif // RNG_H